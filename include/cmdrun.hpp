@@ -2,6 +2,7 @@
 
 #include <algorithm>
 #include <string>
+#include <string_view>
 #include <sstream>
 #include <array>
 #include <vector>
@@ -11,15 +12,66 @@
 #include <set>
 #include <map>
 #include <functional>
+#include <tuple>
+#include <utility>
+#include <type_traits>
+#include <charconv>
+#include <iterator>
+#include <memory>
+#include <cstdint>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
 #include <cassert>
 #include <cctype>
 #include <iostream>
 #include <stdexcept>
 
+// Define to 1 to be able to record spans of command execution with a cmdrun::tracer.
+// It changes the layout of input and command_runner, so all translation units of a
+// program must use the same setting, mixing them violates the one definition rule.
+#ifndef CMDRUN_TRACING
+#define CMDRUN_TRACING 0
+#endif
+
+#if CMDRUN_TRACING
+#include <chrono>
+#include <cstdlib>
+#include <typeinfo>
+#if __has_include(<cxxabi.h>)
+#include <cxxabi.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#define CMDRUN_TRACE_TSC 1
+#include <x86intrin.h>
+#else
+#define CMDRUN_TRACE_TSC 0
+#endif
+#endif
+
+#if !defined(CMDRUN_NO_SIMD) && defined(__SSE2__) && (defined(__GNUC__) || defined(__clang__))
+#define CMDRUN_SIMD_X86 1
+#include <immintrin.h>
+#else
+#define CMDRUN_SIMD_X86 0
+#endif
+
 
 namespace cmdrun {
 
-using command_callback = std::function<void(std::istream&)>;
+class input;
+
+#if CMDRUN_TRACING
+class tracer;
+namespace detail { struct trace_context; }
+#endif
+
+using command_invocation = std::function<void()>;
+
+// parses the arguments of a command and returns a ready to execute call
+using command_callback = std::function<command_invocation(input&)>;
 
 namespace detail {
 
@@ -32,304 +84,1626 @@ struct parsing_error : std::runtime_error
     int error_pos;
 };
 
-inline std::string parse_multiword_string(std::istream& is)
+// same set as std::isspace in the "C" locale
+inline bool is_space(char c)
 {
-    if (is.get() != '"')  {
-        throw parsing_error("Invalid multi-word string (must start with a quotation mark)");
+    return c == ' ' || static_cast<unsigned char>(c - '\t') <= '\r' - '\t';
+}
+
+// smallest power of two not less than value, which must not exceed the largest power of two of T
+template <typename T>
+constexpr T round_up_pow2(T value)
+{
+    T rounded = 1;
+    while (rounded < value) {
+        rounded *= 2;
     }
+    return rounded;
+}
+
+// characters that end a scan
+enum class char_class
+{
+    space,          // ends a word
+    not_space,      // ends a run of whitespace
+    delimiter,      // ends a word inside a '{...}' sequence
+    escape,         // ends the plain part of a multi-word string
+    line_structure  // may end a command line or change its nesting
+};
+
+template <char_class Class>
+bool matches(char c)
+{
+    switch (Class) {
+        case char_class::space: return is_space(c);
+        case char_class::not_space: return !is_space(c);
+        case char_class::delimiter: return is_space(c) || c == ',' || c == '}';
+        case char_class::escape: return c == '"' || c == '\\';
+        case char_class::line_structure: return c == '\n' || c == '"' || c == '{' || c == '}';
+        default: return false;
+    }
+}
+
+#if CMDRUN_SIMD_X86
+
+template <char_class Class>
+unsigned match_mask_sse2(const char* p)
+{
+    const auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
     
-    std::string str;
-    
-    while (is.good() && is.peek() != '"') {
-        char c = is.get();
+    if constexpr (Class == char_class::escape) {
+        return static_cast<unsigned>(_mm_movemask_epi8(_mm_or_si128(
+            _mm_cmpeq_epi8(v, _mm_set1_epi8('"')),
+            _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')))));
+    } else if constexpr (Class == char_class::line_structure) {
+        return static_cast<unsigned>(_mm_movemask_epi8(_mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(v, _mm_set1_epi8('"'))),
+            _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('{')), _mm_cmpeq_epi8(v, _mm_set1_epi8('}'))))));
+    } else {
+        // '\t'..'\r' are the bytes which are at most 4 after subtracting '\t'
+        const auto control = _mm_sub_epi8(v, _mm_set1_epi8('\t'));
+        auto mask = _mm_or_si128(
+            _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+            _mm_cmpeq_epi8(_mm_min_epu8(control, _mm_set1_epi8('\r' - '\t')), control));
         
-        if (c == '\\' && is.peek() == '"') {
-            c = is.get();
+        if constexpr (Class == char_class::delimiter) {
+            mask = _mm_or_si128(mask, _mm_or_si128(
+                _mm_cmpeq_epi8(v, _mm_set1_epi8(',')),
+                _mm_cmpeq_epi8(v, _mm_set1_epi8('}'))));
         }
         
-        str += c;
+        const auto bits = static_cast<unsigned>(_mm_movemask_epi8(mask));
+        return Class == char_class::not_space ? ~bits & 0xffffu : bits;
     }
-    
-    if (is.get() != '"')  {
-        throw parsing_error("Invalid multi-word string (must end with a quotation mark)");
-    }
-    
-    return str;
 }
 
-inline void parse_sequence_delimiter(std::istream& is)
+template <char_class Class>
+__attribute__((target("avx2"))) unsigned match_mask_avx2(const char* p)
 {
-    is >> std::ws;
+    const auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
     
-    if (is.peek() == ',') {
-        is.get();
+    if constexpr (Class == char_class::escape) {
+        return static_cast<unsigned>(_mm256_movemask_epi8(_mm256_or_si256(
+            _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')),
+            _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\')))));
+    } else if constexpr (Class == char_class::line_structure) {
+        return static_cast<unsigned>(_mm256_movemask_epi8(_mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"'))),
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('{')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('}'))))));
+    } else {
+        const auto control = _mm256_sub_epi8(v, _mm256_set1_epi8('\t'));
+        auto mask = _mm256_or_si256(
+            _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+            _mm256_cmpeq_epi8(_mm256_min_epu8(control, _mm256_set1_epi8('\r' - '\t')), control));
+        
+        if constexpr (Class == char_class::delimiter) {
+            mask = _mm256_or_si256(mask, _mm256_or_si256(
+                _mm256_cmpeq_epi8(v, _mm256_set1_epi8(',')),
+                _mm256_cmpeq_epi8(v, _mm256_set1_epi8('}'))));
+        }
+        
+        const auto bits = static_cast<unsigned>(_mm256_movemask_epi8(mask));
+        return Class == char_class::not_space ? ~bits : bits;
     }
 }
 
-template <typename T>
-T parse_sequence_element(std::istream& is)
+template <char_class Class>
+__attribute__((target("avx2"))) const char* scan_avx2(const char* first, const char* last)
 {
-    T element;
-    is >> element;
-    
-    if (!is.good()) {
-        throw parsing_error("Unable to parse sequence element");
+    for (; last - first >= 32; first += 32) {
+        if (const auto mask = match_mask_avx2<Class>(first)) {
+            return first + __builtin_ctz(mask);
+        }
     }
+    
+    return first;
+}
 
-    parse_sequence_delimiter(is);
-    return element;
+inline bool cpu_has_avx2()
+{
+    static const bool has_avx2 = __builtin_cpu_supports("avx2");
+    return has_avx2;
 }
 
-template <>
-inline std::string parse_sequence_element<std::string>(std::istream& is)
+#endif
+
+// Finds the first character of the class, or returns 'last'. Uses AVX2 when
+// the CPU supports it and SSE2 otherwise, the tail is scanned byte by byte.
+template <char_class Class, typename Char>
+Char* scan(Char* first, Char* last)
 {
-    std::string element;
-    is >> std::ws;
+#if CMDRUN_SIMD_X86
+    if (last - first >= 32 && cpu_has_avx2()) {
+        const auto found = scan_avx2<Class>(first, last);
+        first += found - first;
+    }
     
-    if (!is.good() || is.peek() == ',') {
-        throw parsing_error("Missing element");
-    } else if (is.peek() == '"') {
-        element = parse_multiword_string(is);
-    } else {
-        char next = is.peek();
-        while (is.good() && !std::isspace(next) && next != ',' && next != '}' ) {
-            element += is.get();
-            next = is.peek();
+    for (; last - first >= 16; first += 16) {
+        if (const auto mask = match_mask_sse2<Class>(first)) {
+            return first + __builtin_ctz(mask);
         }
     }
+#endif
     
-    parse_sequence_delimiter(is);
-    return element;
-}
-
-inline std::istream& operator>>(std::istream& is, std::string& value)
-{
-    is >> std::ws;
-    
-    if (is.peek() == '"') {
-        value = parse_multiword_string(is);
-        return is;
+    while (first != last && !matches<Class>(*first)) {
+        ++first;
     }
     
-    // parse a single word
-    return std::operator>>(is, value);
+    return first;
 }
 
-template <typename T>
-std::istream& operator>>(std::istream& is, std::vector<T>& container)
+}
+
+// The unparsed rest of a command line, parsers consume it from the front.
+// The characters stay valid until the command callback returns, so parsers
+// may hand out views into them (and rewrite them in place, e.g. to unescape).
+class input
 {
-    is >> std::ws;
+    char* first;
+    char* last;
+    int nesting = 0;
+#if CMDRUN_TRACING
+    const detail::trace_context* trace = nullptr;
+#endif
+
+public:
+    input(char* first_, char* last_):
+        first{first_}, last{last_} {}
     
-    if (is.get() != '{')  {
-        throw parsing_error("Invalid vector (must start with a '{')");
-    }
+    bool empty() const { return first == last; }
+    size_t size() const { return static_cast<size_t>(last - first); }
+    
+    char* begin() const { return first; }
+    char* end() const { return last; }
     
-    is >> std::ws;
+    std::string_view view() const { return {first, size()}; }
     
-    while (is.good() && is.peek() != '}') {
-        container.push_back(parse_sequence_element<T>(is));
+    // precondition for both: !empty()
+    char peek() const { return *first; }
+    char get() { return *first++; }
+    
+    void advance(size_t count) { first += count; }
+    void seek(char* position) { first = position; }
+    
+    void skip_whitespace()
+    {
+        first = detail::scan<detail::char_class::not_space>(first, last);
     }
     
-    if (is.get() != '}')  {
-        throw parsing_error("Invalid vector (must end with a '}')");
+    // number of enclosing '{...}' sequences, words inside them end at ',' and '}'
+    int depth() const { return nesting; }
+    void enter() { ++nesting; }
+    void leave() { --nesting; }
+    
+#if CMDRUN_TRACING
+    // where the spans of the command parsed from this input go, if traced
+    const detail::trace_context* trace_context() const { return trace; }
+    void set_trace_context(const detail::trace_context* trace_) { trace = trace_; }
+#endif
+};
+
+namespace detail {
+
+// an istream source reading the characters of an input without copying them
+class input_streambuf : public std::streambuf
+{
+public:
+    explicit input_streambuf(const input& in)
+    {
+        setg(in.begin(), in.begin(), in.end());
     }
     
-    return is;
+    size_t consumed() const { return static_cast<size_t>(gptr() - eback()); }
+};
+
 }
 
-template <typename... Args>
-std::istream& operator>>(std::istream& is, std::tuple<Args...>& tuple)
+// Customization point for argument types. A specialization provides
+//     static T parse(input& in);
+// which consumes the textual representation of T from the front of 'in'
+// and throws detail::parsing_error when it is malformed. The primary template
+// falls back to an 'operator>>' on std::istream.
+template <typename T, typename Enable = void>
+struct parser
 {
-    is >> std::ws;
-    
-    if (is.get() != '{')  {
-        throw parsing_error("Invalid tuple (must start with a '{')");
+    static T parse(input& in)
+    {
+        detail::input_streambuf buffer(in);
+        std::istream is(&buffer);
+        T value;
+        
+        if (!(is >> value)) {
+            throw detail::parsing_error("Unable to parse argument");
+        }
+        
+        in.advance(buffer.consumed());
+        return value;
+    }
+};
+
+namespace detail {
+
+template <typename T>
+T parse(input& in)
+{
+    return parser<T>::parse(in);
+}
+
+// parses a string in quotation marks in place, only the quotation mark can be escaped
+inline std::string_view parse_multiword_string(input& in)
+{
+    if (in.empty() || in.get() != '"')  {
+        throw parsing_error("Invalid multi-word string (must start with a quotation mark)");
     }
     
-    is >> std::ws;
+    char* const str = in.begin();
+    char* out = str;
+    char* it = str;
     
-    tuple = std::tuple<Args...>{ parse_sequence_element<Args>(is)... };
+    for (;;) {
+        char* const plain = it;
+        it = scan<char_class::escape>(it, in.end());
+        
+        if (out != plain) {
+            std::copy(plain, it, out);
+        }
+        out += it - plain;
+        
+        if (it == in.end() || *it == '"') {
+            break;
+        }
+        
+        // a backslash, it only escapes the quotation mark
+        if (it + 1 != in.end() && it[1] == '"') {
+            ++it;
+        }
+        
+        *out++ = *it++;
+    }
     
-    if (is.get() != '}')  {
-        throw parsing_error("Invalid tuple (must end with a '}')");
+    if (it == in.end())  {
+        throw parsing_error("Invalid multi-word string (must end with a quotation mark)");
     }
     
-    return is;
+    in.seek(it + 1);
+    return {str, static_cast<size_t>(out - str)};
 }
 
-template <typename K, typename V>
-std::istream& operator>>(std::istream& is, std::pair<K, V>& p)
+inline std::string_view parse_word(input& in)
 {
-    std::tuple<K, V> t;
-    is >> t;
-    p = std::make_pair(std::get<0>(t), std::get<1>(t));
-    return is;
+    char* const word = in.begin();
+    char* const it = in.depth() > 0
+        ? scan<char_class::delimiter>(word, in.end())
+        : scan<char_class::space>(word, in.end());
+    
+    in.seek(it);
+    return {word, static_cast<size_t>(it - word)};
 }
 
-template <typename T, size_t N>
-std::istream& operator>>(std::istream& is, std::array<T, N>& container)
+inline void parse_sequence_begin(input& in, const char* type_name)
 {
-    std::vector<T> v;
-    is >> v;
+    in.skip_whitespace();
     
-    if (v.size() != N) {
-        throw parsing_error("Invalid static array initialization (number of elements do not match)");
+    if (in.empty() || in.get() != '{')  {
+        throw parsing_error(std::string("Invalid ") + type_name + " (must start with a '{')");
     }
     
-    std::copy(begin(v), end(v), begin(container));
-    return is;
+    in.enter();
+    in.skip_whitespace();
 }
 
-template <typename ValueType, typename Container>
-std::istream& parse_container(std::istream& is, Container& container)
+inline void parse_sequence_end(input& in, const char* type_name)
 {
-    std::vector<ValueType> vec;
-    is >> vec;
-    container = Container(begin(vec), end(vec));
-    return is;
+    if (in.empty() || in.get() != '}')  {
+        throw parsing_error(std::string("Invalid ") + type_name + " (must end with a '}')");
+    }
+    
+    in.leave();
 }
 
-template <typename Container>
-std::istream& parse_container(std::istream& is, Container& container)
+inline bool sequence_has_next(const input& in)
 {
-    return parse_container<typename Container::value_type>(is, container);
+    return !in.empty() && in.peek() != '}';
 }
 
-template <typename T>
-std::istream& operator>>(std::istream& is, std::deque<T>& container)
+inline void parse_sequence_delimiter(input& in)
 {
-    return parse_container(is, container);
+    in.skip_whitespace();
+    
+    if (!in.empty() && in.peek() == ',') {
+        in.get();
+    }
 }
 
 template <typename T>
-std::istream& operator>>(std::istream& is, std::forward_list<T>& container)
+T parse_sequence_element(input& in)
 {
-    return parse_container(is, container);
+    in.skip_whitespace();
+    
+    if (in.empty() || in.peek() == ',') {
+        throw parsing_error("Missing element");
+    }
+    
+    T element = parse<T>(in);
+    parse_sequence_delimiter(in);
+    return element;
 }
 
-template <typename T>
-std::istream& operator>>(std::istream& is, std::list<T>& container)
+// parses '{a, b, ...}' appending every element to the container
+template <typename Container, typename ValueType = typename Container::value_type>
+struct sequence_parser
 {
-    return parse_container(is, container);
+    static Container parse(input& in)
+    {
+        Container container;
+        parse_sequence_begin(in, "sequence");
+        
+        while (sequence_has_next(in)) {
+            container.insert(container.end(), parse_sequence_element<ValueType>(in));
+        }
+        
+        parse_sequence_end(in, "sequence");
+        return container;
+    }
+};
+
+template <typename T>
+struct is_character : std::false_type {};
+
+template <> struct is_character<char> : std::true_type {};
+template <> struct is_character<signed char> : std::true_type {};
+template <> struct is_character<unsigned char> : std::true_type {};
+
+template <typename T>
+inline constexpr bool is_number_v =
+    std::is_arithmetic_v<T> && !std::is_same_v<T, bool> && !is_character<T>::value;
+
 }
 
 template <typename T>
-std::istream& operator>>(std::istream& is, std::set<T>& container)
+struct parser<T, std::enable_if_t<detail::is_number_v<T>>>
 {
-    return parse_container(is, container);
-}
+    static T parse(input& in)
+    {
+        in.skip_whitespace();
+        
+        // accepted by streams, but not by from_chars, a sign must not follow
+        if (in.size() > 1 && in.peek() == '+'
+                && (std::isdigit(static_cast<unsigned char>(in.begin()[1])) || in.begin()[1] == '.')) {
+            in.get();
+        }
+        
+        T value{};
+        const auto [end, error] = std::from_chars(in.begin(), in.end(), value);
+        
+        if (error != std::errc{}) {
+            throw detail::parsing_error("Invalid number");
+        }
+        
+        in.advance(static_cast<size_t>(end - in.begin()));
+        return value;
+    }
+};
 
-template <typename K, typename V>
-std::istream& operator>>(std::istream& is, std::map<K, V>& container)
+template <>
+struct parser<bool>
 {
-    return parse_container<std::pair<K, V>>(is, container);
-}
+    static bool parse(input& in)
+    {
+        in.skip_whitespace();
+        const auto word = detail::parse_word(in);
+        
+        if (word == "1" || word == "true") {
+            return true;
+        } else if (word == "0" || word == "false") {
+            return false;
+        }
+        
+        throw detail::parsing_error("Invalid boolean");
+    }
+};
 
 template <typename T>
-std::istream& operator>>(std::istream& is, std::multiset<T>& container)
+struct parser<T, std::enable_if_t<detail::is_character<T>::value>>
 {
-    return parse_container(is, container);
-}
+    static T parse(input& in)
+    {
+        in.skip_whitespace();
+        
+        if (in.empty()) {
+            throw detail::parsing_error("Missing character");
+        }
+        
+        return static_cast<T>(in.get());
+    }
+};
 
-template <typename K, typename V>
-std::istream& operator>>(std::istream& is, std::multimap<K, V>& container)
+// a view into the command line, valid until the command callback returns
+template <>
+struct parser<std::string_view>
 {
-    return parse_container<std::pair<K, V>>(is, container);
-}
+    static std::string_view parse(input& in)
+    {
+        in.skip_whitespace();
+        
+        if (!in.empty() && in.peek() == '"') {
+            return detail::parse_multiword_string(in);
+        }
+        
+        return detail::parse_word(in);
+    }
+};
+
+template <>
+struct parser<std::string>
+{
+    static std::string parse(input& in)
+    {
+        return std::string(parser<std::string_view>::parse(in));
+    }
+};
 
 template <typename T>
-T parse(std::istream& is)
+struct parser<std::vector<T>> : detail::sequence_parser<std::vector<T>> {};
+
+template <typename T>
+struct parser<std::deque<T>> : detail::sequence_parser<std::deque<T>> {};
+
+template <typename T>
+struct parser<std::list<T>> : detail::sequence_parser<std::list<T>> {};
+
+template <typename T>
+struct parser<std::set<T>> : detail::sequence_parser<std::set<T>> {};
+
+template <typename T>
+struct parser<std::multiset<T>> : detail::sequence_parser<std::multiset<T>> {};
+
+template <typename K, typename V>
+struct parser<std::map<K, V>> : detail::sequence_parser<std::map<K, V>, std::pair<K, V>> {};
+
+template <typename K, typename V>
+struct parser<std::multimap<K, V>> : detail::sequence_parser<std::multimap<K, V>, std::pair<K, V>> {};
+
+template <typename T>
+struct parser<std::forward_list<T>>
 {
-    T value;
-    is >> value;
-    return value;
-}
+    static std::forward_list<T> parse(input& in)
+    {
+        auto vec = parser<std::vector<T>>::parse(in);
+        return std::forward_list<T>(begin(vec), end(vec));
+    }
+};
 
-template <typename Ret, typename... Args>
-command_callback create_function_call(std::function<Ret(Args...)> f)
+template <typename T, size_t N>
+struct parser<std::array<T, N>>
 {
-    return
-        [f](std::istream& params) {
-            auto args = std::tuple<Args...>{ parse<Args>(params)... };
-            (void)std::apply(f, args);
-        };
-}
+    static std::array<T, N> parse(input& in)
+    {
+        std::array<T, N> container;
+        size_t count = 0;
+        
+        detail::parse_sequence_begin(in, "static array");
+        
+        for (; detail::sequence_has_next(in); count++) {
+            auto element = detail::parse_sequence_element<T>(in);
+            if (count < N) {
+                container[count] = std::move(element);
+            }
+        }
+        
+        detail::parse_sequence_end(in, "static array");
+        
+        if (count != N) {
+            throw detail::parsing_error("Invalid static array initialization (number of elements do not match)");
+        }
+        
+        return container;
+    }
+};
 
-template <typename T, typename R, typename... Args>
-auto bind_object(R(T::*method_ptr)(Args...), T& object)
+template <typename... Args>
+struct parser<std::tuple<Args...>>
 {
-    return [&object, method_ptr](Args... args) {
-        (object.*method_ptr)(std::forward<Args>(args)...);
-    };
-}
+    static std::tuple<Args...> parse(input& in)
+    {
+        detail::parse_sequence_begin(in, "tuple");
+        auto tuple = std::tuple<Args...>{ detail::parse_sequence_element<Args>(in)... };
+        detail::parse_sequence_end(in, "tuple");
+        return tuple;
+    }
+};
 
-}
+template <typename K, typename V>
+struct parser<std::pair<K, V>>
+{
+    static std::pair<K, V> parse(input& in)
+    {
+        auto [key, value] = parser<std::tuple<K, V>>::parse(in);
+        return {std::move(key), std::move(value)};
+    }
+};
 
-// helper macros for creating command objects, added 'COMMAND' for consistency
-#define COMMAND(name, callable) cmdrun::command{name, callable}
-#define FUNCTION(function_name) COMMAND(#function_name, function_name)
-#define METHOD(object, method) cmdrun::command{#method, detail::bind_object(&decltype(object)::method, object)}
+#if CMDRUN_TRACING
 
+namespace detail {
 
-struct command
+inline uint64_t steady_nanoseconds()
 {
-public:
-    template <typename Callback>
-    command(const std::string& name_, Callback callback_):
-        name{name_}
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// time stamp of a span, converted to nanoseconds only when a trace is written
+inline uint64_t trace_clock()
+{
+#if CMDRUN_TRACE_TSC
+    return __rdtsc();
+#else
+    return steady_nanoseconds();
+#endif
+}
+
+// command name stored in a span, truncated
+struct trace_label
+{
+    char text[24];
+    
+    trace_label(std::string_view name = {})
     {
-        std::function callback_fn = std::forward<Callback>(callback_);
-        callback = cmdrun::detail::create_function_call(callback_fn);
+        const auto length = std::min(name.size(), sizeof(text) - 1);
+        std::copy_n(name.data(), length, text);
+        text[length] = '\0';
     }
-    
-    std::string name;
-    command_callback callback;
 };
 
+// a single cache line
+struct alignas(64) trace_span
+{
+    const char* name;           // static string, the kind of the span
+    const char* type;           // mangled type name of a parsed argument or nullptr
+    uint64_t start;
+    uint64_t end;
+    uint64_t bytes;
+    trace_label command;
+};
 
-class command_runner {
-    std::vector<command> commands;
+static_assert(sizeof(trace_span) == 64, "spans are written as single cache lines");
+
+// The latest spans of a single thread in a preallocated ring. Only that thread
+// records, anyone may read the spans published so far without locking.
+class trace_buffer
+{
+    const std::unique_ptr<trace_span[]> spans;
+    const uint64_t capacity;
+    std::atomic<uint64_t> claimed{0};       // spans started, their slots may be overwritten
+    std::atomic<uint64_t> published{0};     // spans completely written
+    uint64_t last_end = 0;
     
 public:
-    command_runner(const command& command_):
-        commands{command_} {}
+    const std::thread::id thread;
+    const size_t index;
     
-    command_runner(const std::vector<command>& commands_ = {}):
-        commands{commands_} {}
+    // capacity must be a power of two, the ring is touched here rather than when recording
+    trace_buffer(uint64_t capacity_, std::thread::id thread_, size_t index_):
+        spans{new trace_span[capacity_]()}, capacity{capacity_}, thread{thread_}, index{index_} {}
     
-    void run(int argc, const char* argv[]) const
+    // end of the span recorded last, the start of a directly following one
+    uint64_t previous_end() const { return last_end; }
+    
+    void record(const char* name, uint64_t start, uint64_t end,
+                const trace_label& command = {}, const char* type = nullptr, uint64_t bytes = 0)
     {
-        std::ostringstream cmd_stream;
-
-        for (int i=1; i<argc; i++) {
-            auto param = std::string(argv[i]);
-            if (std::find_if(begin(param), end(param), ::isspace) != end(param)) {
-                param = '"' + param + '"'; 
-            }
-            cmd_stream << param << ' ';
-        }
+        const auto count = published.load(std::memory_order_relaxed);
         
-        return run(cmd_stream.str());
+        claimed.store(count + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        
+        auto& span = spans[count & (capacity - 1)];
+        span.name = name;
+        span.type = type;
+        span.start = start;
+        span.end = end;
+        span.bytes = bytes;
+        span.command = command;
+        
+        last_end = end;
+        published.store(count + 1, std::memory_order_release);
     }
     
-    void run(const std::string& command_line) const
+    template <typename Visitor>
+    void for_each(Visitor visit) const
     {
-        std::istringstream cmd_stream(command_line);
-        std::string command;
+        const auto count = published.load(std::memory_order_acquire);
+        auto first = count > capacity ? count - capacity : 0;
         
-        cmd_stream >> command;
+        std::vector<trace_span> copy;
+        for (auto i = first; i != count; i++) {
+            copy.push_back(spans[i & (capacity - 1)]);
+        }
         
-        const auto it = std::find_if(begin(commands), end(commands),
+        // spans whose slots were reused while copying are skipped
+        std::atomic_thread_fence(std::memory_order_acquire);
+        const auto reused = claimed.load(std::memory_order_relaxed);
+        const auto valid = reused > capacity ? reused - capacity : 0;
+        
+        for (auto i = first; i != count; i++) {
+            if (i >= valid) {
+                visit(copy[i - first]);
+            }
+        }
+    }
+};
+
+// passed to the parsers and the invocation of a traced command
+struct trace_context
+{
+    tracer* sink;
+    trace_buffer* buffer;       // of the parsing thread
+    trace_label command;
+};
+
+inline std::string demangle(const char* name)
+{
+#if __has_include(<cxxabi.h>)
+    int status = 0;
+    std::unique_ptr<char, void(*)(void*)> demangled{
+        abi::__cxa_demangle(name, nullptr, nullptr, &status), std::free};
+    
+    if (status == 0 && demangled) {
+        return demangled.get();
+    }
+#endif
+    return name;
+}
+
+inline void write_json_string(std::ostream& os, std::string_view str)
+{
+    os << '"';
+    
+    for (char c : str) {
+        if (c == '"' || c == '\\') {
+            os << '\\' << c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            const char* hex = "0123456789abcdef";
+            os << "\\u00" << hex[(c >> 4) & 0xf] << hex[c & 0xf];
+        } else {
+            os << c;
+        }
+    }
+    
+    os << '"';
+}
+
+// nanoseconds written as the microseconds expected by the trace event format
+inline void write_microseconds(std::ostream& os, uint64_t ns)
+{
+    const auto fraction = ns % 1000;
+    os << ns / 1000 << '.' << fraction / 100 << fraction / 10 % 10 << fraction % 10;
+}
+
+}
+
+// Collects spans of the commands run by the runners it is attached to
+// (see command_runner::set_tracer) in lock-free per-thread buffers, each
+// keeping the latest spans_per_thread spans.
+class tracer
+{
+    static uint64_t next_id()
+    {
+        static std::atomic<uint64_t> id{1};
+        return id.fetch_add(1, std::memory_order_relaxed);
+    }
+    
+    const uint64_t id = next_id();
+    const uint64_t spans_per_thread;
+    const uint64_t origin_ticks = detail::trace_clock();
+    const uint64_t origin_ns = detail::steady_nanoseconds();
+    mutable std::mutex buffers_mutex;
+    std::vector<std::unique_ptr<detail::trace_buffer>> buffers;
+    
+    // trace_clock ticks per nanosecond, measured against the steady clock since construction
+    double ticks_per_ns() const
+    {
+#if CMDRUN_TRACE_TSC
+        constexpr uint64_t min_interval_ns = 10'000'000;
+        
+        auto elapsed_ns = detail::steady_nanoseconds() - origin_ns;
+        if (elapsed_ns < min_interval_ns) {
+            std::this_thread::sleep_for(std::chrono::nanoseconds(min_interval_ns - elapsed_ns));
+        }
+        
+        const auto ticks = detail::trace_clock() - origin_ticks;
+        elapsed_ns = detail::steady_nanoseconds() - origin_ns;
+        return static_cast<double>(ticks) / static_cast<double>(elapsed_ns);
+#else
+        return 1;
+#endif
+    }
+    
+public:
+    // spans_per_thread is rounded up to a power of two
+    explicit tracer(uint64_t spans_per_thread_ = 1 << 16):
+        spans_per_thread{detail::round_up_pow2(spans_per_thread_)} {}
+    tracer(const tracer&) = delete;
+    tracer& operator=(const tracer&) = delete;
+    
+    // the buffer of the calling thread, only its first use on a thread takes a lock
+    detail::trace_buffer& this_thread_buffer()
+    {
+        thread_local uint64_t cached_id = 0;
+        thread_local detail::trace_buffer* cached_buffer = nullptr;
+        
+        if (cached_id != id) {
+            const auto thread = std::this_thread::get_id();
+            std::lock_guard<std::mutex> lock(buffers_mutex);
+            
+            const auto it = std::find_if(begin(buffers), end(buffers),
+                [thread](const auto& buffer) {
+                    return buffer->thread == thread;
+                });
+            
+            if (it != end(buffers)) {
+                cached_buffer = it->get();
+            } else {
+                buffers.push_back(std::make_unique<detail::trace_buffer>(spans_per_thread, thread, buffers.size() + 1));
+                cached_buffer = buffers.back().get();
+            }
+            
+            cached_id = id;
+        }
+        
+        return *cached_buffer;
+    }
+    
+    // Writes all spans recorded so far in the Chrome trace event format,
+    // which can be opened in Perfetto or chrome://tracing.
+    void write_chrome_trace(std::ostream& os) const
+    {
+        const auto rate = ticks_per_ns();
+        
+        // relative to the construction, counters of different cores may be slightly apart
+        auto to_ns = [&](uint64_t ticks) {
+            const auto ns = static_cast<double>(static_cast<int64_t>(ticks - origin_ticks)) / rate;
+            return ns > 0 ? static_cast<uint64_t>(ns) : uint64_t{0};
+        };
+        
+        std::lock_guard<std::mutex> lock(buffers_mutex);
+        const char* separator = "\n";
+        
+        os << "{\"traceEvents\":[";
+        
+        for (const auto& buffer : buffers) {
+            buffer->for_each([&](const detail::trace_span& span) {
+                const auto start = to_ns(span.start);
+                const auto end = std::max(start, to_ns(span.end));
+                
+                os << separator << "{\"name\":";
+                detail::write_json_string(os, span.name);
+                os << ",\"cat\":\"cmdrun\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->index << ",\"ts\":";
+                detail::write_microseconds(os, start);
+                os << ",\"dur\":";
+                detail::write_microseconds(os, end - start);
+                os << ",\"args\":{\"command\":";
+                detail::write_json_string(os, span.command.text);
+                
+                if (span.type) {
+                    os << ",\"type\":";
+                    detail::write_json_string(os, detail::demangle(span.type));
+                    os << ",\"bytes\":" << span.bytes;
+                }
+                
+                os << "}}";
+                separator = ",\n";
+            });
+        }
+        
+        os << "\n],\"displayTimeUnit\":\"ns\"}\n";
+    }
+};
+
+#endif
+
+namespace detail {
+
+// parses a value from a stream, the stream must be seekable to parse more than one value
+template <typename T>
+T parse(std::istream& is)
+{
+    const auto start = is.tellg();
+    std::string buffer{std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>()};
+    
+    input in(buffer.data(), buffer.data() + buffer.size());
+    T value = parse<T>(in);
+    
+    is.clear();
+    if (start != std::istream::pos_type(-1)) {
+        is.seekg(start + static_cast<std::streamoff>(buffer.size() - in.size()));
+    }
+    
+    return value;
+}
+
+template <typename T>
+struct type_tag {};
+
+// signature of any callable accepted by std::function, deduced without
+// instantiating std::function itself
+template <typename Callable>
+using function_signature = type_tag<decltype(std::function{std::declval<Callable>()})>;
+
+template <typename Callable, typename Tuple, size_t... I>
+void invoke_with(Callable& f, Tuple& args, std::index_sequence<I...>)
+{
+    (void)f(std::get<I>(args)...);
+}
+
+template <typename T>
+T parse_argument(input& in)
+{
+#if CMDRUN_TRACING
+    if (const auto* trace = in.trace_context()) {
+        // arguments are parsed right after the lookup or the previous argument
+        const auto start = trace->buffer->previous_end();
+        const char* const first = in.begin();
+        T value = parse<T>(in);
+        trace->buffer->record("parse", start, trace_clock(), trace->command,
+                              typeid(T).name(), static_cast<uint64_t>(in.begin() - first));
+        return value;
+    }
+#endif
+    return parse<T>(in);
+}
+
+template <typename Callable, typename Ret, typename... Args>
+command_callback create_function_call(Callable f, type_tag<std::function<Ret(Args...)>>)
+{
+    // shared by all invocations, a stateful callable keeps its state between commands
+    auto callable = std::make_shared<Callable>(std::move(f));
+    
+    return
+        [callable](input& params) -> command_invocation {
+            auto args = std::tuple<std::decay_t<Args>...>{ parse_argument<std::decay_t<Args>>(params)... };
+            
+#if CMDRUN_TRACING
+            // executed later and possibly on another thread
+            if (const auto* trace = params.trace_context()) {
+                return [callable, args = std::move(args), sink = trace->sink, command = trace->command]() mutable {
+                    const auto start = trace_clock();
+                    invoke_with(*callable, args, std::index_sequence_for<Args...>{});
+                    sink->this_thread_buffer().record("execute", start, trace_clock(), command);
+                };
+            }
+#endif
+            return [callable, args = std::move(args)]() mutable {
+                invoke_with(*callable, args, std::index_sequence_for<Args...>{});
+            };
+        };
+}
+
+template <typename T, typename R, typename... Args>
+auto bind_object(R(T::*method_ptr)(Args...), T& object)
+{
+    return [&object, method_ptr](Args... args) {
+        (object.*method_ptr)(std::forward<Args>(args)...);
+    };
+}
+
+// bounded single-producer single-consumer queue, capacity is rounded up to a power of two
+template <typename T>
+class spsc_queue
+{
+    static constexpr size_t cache_line = 64;
+    static constexpr int spin_count = 1000;
+    
+    std::vector<T> slots;
+    const size_t mask;
+    
+    alignas(cache_line) std::atomic<size_t> head{0};
+    size_t cached_tail = 0;
+    
+    alignas(cache_line) std::atomic<size_t> tail{0};
+    size_t cached_head = 0;
+    
+    // the slow path of the blocking operations
+    alignas(cache_line) std::atomic<int> sleepers{0};
+    std::mutex wait_mutex;
+    std::condition_variable wakeup;
+    
+    template <typename Ready>
+    void wait_until(Ready ready)
+    {
+        for (int spins = 0; spins < spin_count; spins++) {
+            if (ready()) {
+                return;
+            }
+        }
+        
+        std::unique_lock<std::mutex> lock(wait_mutex);
+        sleepers.fetch_add(1, std::memory_order_relaxed);
+        
+        // pairs with the fence in notify(), either the waker sees the sleeper or the sleeper sees the change
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        wakeup.wait(lock, ready);
+        
+        sleepers.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+public:
+    explicit spsc_queue(size_t capacity):
+        slots(round_up_pow2(std::max<size_t>(capacity, 2))), mask{slots.size() - 1} {}
+    
+    spsc_queue(const spsc_queue&) = delete;
+    spsc_queue& operator=(const spsc_queue&) = delete;
+    
+    // producer side
+    bool try_push(T& value)
+    {
+        const auto t = tail.load(std::memory_order_relaxed);
+        
+        if (t - cached_head == slots.size()) {
+            cached_head = head.load(std::memory_order_acquire);
+            if (t - cached_head == slots.size()) {
+                return false;
+            }
+        }
+        
+        slots[t & mask] = std::move(value);
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+    
+    // consumer side
+    bool try_pop(T& value)
+    {
+        const auto h = head.load(std::memory_order_relaxed);
+        
+        if (h == cached_tail) {
+            cached_tail = tail.load(std::memory_order_acquire);
+            if (h == cached_tail) {
+                return false;
+            }
+        }
+        
+        value = std::move(slots[h & mask]);
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+    
+    // The blocking variants spin for a while and then sleep until they succeed.
+    // push() also gives up once 'cancelled' is set and notify() is called.
+    bool push(T& value, const std::atomic<bool>& cancelled)
+    {
+        bool pushed = false;
+        wait_until([&]() {
+            pushed = try_push(value);
+            return pushed || cancelled.load(std::memory_order_relaxed);
+        });
+        
+        if (pushed) {
+            notify();
+        }
+        return pushed;
+    }
+    
+    void pop(T& value)
+    {
+        wait_until([&]() { return try_pop(value); });
+        notify();
+    }
+    
+    // wakes the other side when it sleeps, e.g. after a change of 'cancelled'
+    void notify()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        
+        if (sleepers.load(std::memory_order_relaxed) != 0) {
+            std::lock_guard<std::mutex> lock(wait_mutex);
+            wakeup.notify_all();
+        }
+    }
+};
+
+// Holds a value which is read without locks and replaced as a whole. A replaced
+// value is deleted once all read sections which might have seen it are left.
+// Readers are counted per phase in per-thread shards, a writer flips the phase
+// and waits for the readers of the previous one (a minimal RCU).
+template <typename T>
+class rcu_value
+{
+    static constexpr size_t cache_line = 64;
+    static constexpr size_t shard_count = 16;
+    
+    struct alignas(cache_line) shard
+    {
+        std::atomic<size_t> readers{0};
+    };
+    
+    static size_t this_thread_shard()
+    {
+        static std::atomic<size_t> next_shard{0};
+        thread_local const size_t index = next_shard.fetch_add(1, std::memory_order_relaxed) % shard_count;
+        return index;
+    }
+    
+    std::atomic<const T*> value;
+    std::atomic<uint64_t> updates{0};
+    std::atomic<size_t> phase{0};
+    mutable std::array<std::array<shard, shard_count>, 2> shards;
+    std::mutex writer;
+    
+public:
+    class read_section
+    {
+        friend class rcu_value;
+        
+        std::atomic<size_t>& readers;
+        const T* value;
+        
+        read_section(std::atomic<size_t>& readers_, const T* value_):
+            readers{readers_}, value{value_} {}
+        
+    public:
+        read_section(const read_section&) = delete;
+        read_section& operator=(const read_section&) = delete;
+        
+        ~read_section()
+        {
+            readers.fetch_sub(1, std::memory_order_release);
+        }
+        
+        const T& operator*() const { return *value; }
+        const T* operator->() const { return value; }
+    };
+    
+    explicit rcu_value(T initial):
+        value{new T(std::move(initial))} {}
+    
+    rcu_value(const rcu_value& other):
+        rcu_value(*other.read()) {}
+    
+    rcu_value& operator=(const rcu_value& other)
+    {
+        T snapshot = *other.read();
+        update([&](const T&) { return std::move(snapshot); });
+        return *this;
+    }
+    
+    ~rcu_value()
+    {
+        delete value.load(std::memory_order_relaxed);
+    }
+    
+    // number of updates so far, a later read() sees at least the value of the last one counted
+    uint64_t generation() const
+    {
+        return updates.load(std::memory_order_acquire);
+    }
+    
+    // the value stays alive at least until the returned section is destroyed
+    read_section read() const
+    {
+        const auto index = this_thread_shard();
+        
+        for (;;) {
+            const auto current = phase.load(std::memory_order_seq_cst);
+            auto& readers = shards[current][index].readers;
+            readers.fetch_add(1, std::memory_order_seq_cst);
+            
+            // A writer may flip the phase between the load and the increment and then
+            // not wait for this reader. Once the phase is seen unchanged after the
+            // increment, the next flip away from it happens later and waits for this
+            // reader, and only that flip's writer may delete the value loaded below.
+            if (phase.load(std::memory_order_seq_cst) == current) {
+                return read_section(readers, value.load(std::memory_order_seq_cst));
+            }
+            
+            readers.fetch_sub(1, std::memory_order_release);
+        }
+    }
+    
+    // replaces the value with make_value(current value), must not be called within a read section
+    template <typename MakeValue>
+    void update(MakeValue make_value)
+    {
+        std::lock_guard<std::mutex> lock(writer);
+        
+        const T* old_value = value.load(std::memory_order_relaxed);
+        value.store(new T(make_value(*old_value)), std::memory_order_seq_cst);
+        updates.fetch_add(1, std::memory_order_release);
+        
+        const auto old_phase = phase.load(std::memory_order_relaxed);
+        phase.store(1 - old_phase, std::memory_order_seq_cst);
+        
+        for (const auto& readers : shards[old_phase]) {
+            while (readers.readers.load(std::memory_order_seq_cst) != 0) {
+                std::this_thread::yield();
+            }
+        }
+        
+        delete old_value;
+    }
+};
+
+}
+
+// helper macros for creating command objects, added 'COMMAND' for consistency
+#define COMMAND(name, callable) cmdrun::command{name, callable}
+#define FUNCTION(function_name) COMMAND(#function_name, function_name)
+#define METHOD(object, method) cmdrun::command{#method, detail::bind_object(&decltype(object)::method, object)}
+
+
+struct command
+{
+public:
+    template <typename Callback>
+    command(const std::string& name_, Callback callback_):
+        name{name_},
+        callback{cmdrun::detail::create_function_call(callback_, detail::function_signature<Callback>{})} {}
+    
+    std::string name;
+    command_callback callback;
+};
+
+
+class command_runner {
+    // replaced as a whole, calls running on other threads keep the table they started with
+    detail::rcu_value<std::vector<command>> commands;
+    
+    // one parsed command line travelling from the parsing to the executing thread,
+    // the arguments of the call may point into the line, which parsers may have rewritten
+    struct pipeline_item
+    {
+        std::string source;
+        std::vector<char> line;
+        uint64_t generation = 0;    // of the command table the line was prepared with
+        command_invocation call;
+        std::exception_ptr error;
+        bool last = false;
+        
+        void prepare(const command_runner& runner)
+        {
+            line.assign(begin(source), end(source));
+            generation = runner.commands.generation();
+            error = nullptr;
+            
+            try {
+                call = runner.prepare(line.data(), line.data() + line.size());
+            } catch (...) {
+                call = {};
+                error = std::current_exception();
+            }
+        }
+    };
+    
+    command_invocation prepare(char* first, char* last) const
+    {
+#if CMDRUN_TRACING
+        if (active_tracer) {
+            return prepare_traced(first, last);
+        }
+#endif
+        input in(first, last);
+        in.skip_whitespace();
+        
+        const auto command = detail::parse_word(in);
+        const auto table = commands.read();
+        
+        const auto it = std::find_if(begin(*table), end(*table),
+            [&command](const auto& cmd) {
+                return cmd.name == command;
+            });
+        
+        if (it != end(*table) && it->callback) {
+            return it->callback(in);
+        }
+        
+        return {};
+    }
+    
+#if CMDRUN_TRACING
+    tracer* active_tracer = nullptr;
+    
+    command_invocation prepare_traced(char* first, char* last) const
+    {
+        auto& trace = active_tracer->this_thread_buffer();
+        const auto tokenize_start = detail::trace_clock();
+        
+        input in(first, last);
+        in.skip_whitespace();
+        
+        const auto command = detail::parse_word(in);
+        const detail::trace_context context{active_tracer, &trace, command};
+        in.set_trace_context(&context);
+        
+        const auto lookup_start = detail::trace_clock();
+        trace.record("tokenize", tokenize_start, lookup_start, context.command);
+        
+        const auto table = commands.read();
+        const auto it = std::find_if(begin(*table), end(*table),
             [&command](const auto& cmd) {
                 return cmd.name == command;
             });
         
-        if (it != end(commands) && it->callback) {
-            it->callback(cmd_stream);
+        trace.record("lookup", lookup_start, detail::trace_clock(), context.command);
+        
+        if (it == end(*table) || !it->callback) {
+            return {};
+        }
+        
+        // the invocation records its execution itself
+        return it->callback(in);
+    }
+#endif
+    
+public:
+    command_runner(const command& command_):
+        commands{{command_}} {}
+    
+    command_runner(const std::vector<command>& commands_ = {}):
+        commands{commands_} {}
+    
+#if CMDRUN_TRACING
+    // Records spans of the following commands into the tracer, nullptr stops tracing.
+    // The tracer must outlive all commands run, it may only be changed while none run.
+    void set_tracer(tracer* tracer_)
+    {
+        active_tracer = tracer_;
+    }
+    
+#endif
+    // The following replace the command table atomically. They may be called while
+    // other threads run commands and from command callbacks, but not from parsers.
+    
+    void set_commands(const std::vector<command>& commands_)
+    {
+        commands.update([&](const auto&) { return commands_; });
+    }
+    
+    // adds a command or replaces the one with the same name
+    void add_command(const command& command_)
+    {
+        commands.update([&](const auto& table) {
+            auto updated = table;
+            const auto it = std::find_if(begin(updated), end(updated),
+                [&command_](const auto& cmd) {
+                    return cmd.name == command_.name;
+                });
+            
+            if (it != end(updated)) {
+                *it = command_;
+            } else {
+                updated.push_back(command_);
+            }
+            
+            return updated;
+        });
+    }
+    
+    void remove_command(const std::string& name)
+    {
+        commands.update([&](const auto& table) {
+            auto updated = table;
+            updated.erase(std::remove_if(begin(updated), end(updated),
+                [&name](const auto& cmd) {
+                    return cmd.name == name;
+                }), end(updated));
+            
+            return updated;
+        });
+    }
+    
+    void run(int argc, const char* argv[]) const
+    {
+        std::ostringstream cmd_stream;
+
+        for (int i=1; i<argc; i++) {
+            auto param = std::string(argv[i]);
+            if (std::find_if(begin(param), end(param), ::isspace) != end(param)) {
+                param = '"' + param + '"'; 
+            }
+            cmd_stream << param << ' ';
+        }
+        
+        return run(cmd_stream.str());
+    }
+    
+    void run(const std::string& command_line) const
+    {
+        // parsers may rewrite the line in place, short lines are copied to the stack
+        std::array<char, 256> local_line;
+        std::vector<char> heap_line;
+        char* line = local_line.data();
+        
+        if (command_line.size() > local_line.size()) {
+            heap_line.resize(command_line.size());
+            line = heap_line.data();
+        }
+        
+        std::copy(begin(command_line), end(command_line), line);
+        run_in_place(line, line + command_line.size());
+    }
+    
+    // runs a command line stored in a caller owned buffer, parsers may rewrite it
+    void run_in_place(char* first, char* last) const
+    {
+        if (auto call = prepare(first, last)) {
+            call();
+        }
+    }
+    
+    // Runs every line of the input as a command. Lines are tokenized and parsed
+    // on a separate thread while the calling thread executes the callbacks in
+    // input order. A parsing error is rethrown once all preceding commands ran.
+    // Lines parsed ahead of a command which replaces the commands are parsed again.
+    void run_pipelined(std::istream& script, size_t queue_capacity = 64) const
+    {
+        detail::spsc_queue<pipeline_item> queue(queue_capacity);
+        std::atomic<bool> cancelled{false};
+        
+        std::thread producer([&]() {
+            pipeline_item item;
+            
+            try {
+                while (std::getline(script, item.source)) {
+                    item.prepare(*this);
+                    
+                    // unknown commands travel as well, a preceding command may add them
+                    if (!queue.push(item, cancelled)) {
+                        return;
+                    }
+                }
+                
+                item = pipeline_item{};
+            } catch (...) {
+                item = pipeline_item{};
+                item.error = std::current_exception();
+            }
+            
+            item.last = true;
+            queue.push(item, cancelled);
+        });
+        
+        try {
+            pipeline_item item;
+            
+            while (!item.last) {
+                queue.pop(item);
+                
+                // the command table was replaced, e.g. by a preceding command, after the line was prepared
+                if (!item.last && item.generation != commands.generation()) {
+                    item.prepare(*this);
+                }
+                
+                if (item.error) {
+                    std::rethrow_exception(item.error);
+                }
+                
+                if (item.call) {
+                    item.call();
+                }
+            }
+        } catch (...) {
+            cancelled = true;
+            queue.notify();
+            producer.join();
+            throw;
         }
+        
+        producer.join();
     }
     
 };
 
-}
+// Runs commands from input which arrives in arbitrary chunks, e.g. from a socket.
+// Commands end with a newline outside of quotation marks and '{...}', the state
+// of an unfinished command is kept between chunks. A command is run as soon as
+// its terminating newline is fed, in place when it lies within a single chunk.
+// A command longer than max_command_size fails, it is skipped up to the next newline.
+// There is no limit by default, input from untrusted peers should set one.
+class push_parser
+{
+    enum class state
+    {
+        plain,
+        quoted,
+        quoted_backslash,
+        discarding
+    };
+    
+    const command_runner& runner;
+    const size_t max_command_size;
+    std::vector<char> pending;      // start of a command spanning several chunks
+    std::vector<char> chunk_copy;
+    state current = state::plain;
+    int depth = 0;
+    bool chunk_at_token_start = true;   // whether the next chunk starts where a parser would begin
+    std::exception_ptr error;
+    
+    // Quotation marks and braces only have a meaning where an argument parser begins,
+    // i.e. after whitespace, after a ',' or a '{' within a sequence, after the '}'
+    // closing one and after a closing quotation mark. The latter three are recorded
+    // while feeding as 'boundary', the characters right behind them.
+    bool is_token_start(const char* pos, const char* first, const char* boundary, bool boundary_token_start) const
+    {
+        if (pos == first) {
+            return chunk_at_token_start;
+        }
+        
+        if (pos == boundary) {
+            return boundary_token_start;
+        }
+        
+        return detail::is_space(pos[-1]) || (pos[-1] == ',' && depth > 0);
+    }
+    
+    void dispatch(char* first, char* last)
+    {
+        try {
+            if (pending.empty()) {
+                runner.run_in_place(first, last);
+            } else {
+                auto line = std::move(pending);
+                pending.clear();
+                line.insert(end(line), first, last);
+                runner.run_in_place(line.data(), line.data() + line.size());
+            }
+        } catch (...) {
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+    }
+    
+    size_t command_size(const char* command, const char* it) const
+    {
+        return pending.size() + static_cast<size_t>(it - command);
+    }
+    
+    // drops the command, e.g. one with an unbalanced quotation mark, instead of buffering it forever
+    void discard_command()
+    {
+        if (!error) {
+            error = std::make_exception_ptr(detail::parsing_error("Command exceeds the maximum size"));
+        }
+        
+        pending.clear();
+        current = state::discarding;
+        depth = 0;
+    }
+    
+    void rethrow_error()
+    {
+        if (error) {
+            std::rethrow_exception(std::exchange(error, nullptr));
+        }
+    }
+    
+public:
+    explicit push_parser(const command_runner& runner_, size_t max_command_size_ = SIZE_MAX):
+        runner{runner_}, max_command_size{max_command_size_} {}
+    
+    // The chunk may be rewritten by the parsers. The first exception thrown by a command
+    // is rethrown once the whole chunk has been consumed, the following commands still run.
+    void feed(char* first, char* last)
+    {
+        char* command = first;
+        char* it = first;
+        const char* boundary = nullptr;
+        bool boundary_token_start = false;
+        
+        while (it != last) {
+            if (current == state::discarding) {
+                it = std::find(it, last, '\n');
+                if (it == last) {
+                    break;
+                }
+                
+                current = state::plain;
+                command = it + 1;
+            } else if (current == state::plain) {
+                it = detail::scan<detail::char_class::line_structure>(it, last);
+                if (it == last) {
+                    break;
+                }
+                
+                const bool token_start = is_token_start(it, first, boundary, boundary_token_start);
+                boundary = it + 1;
+                boundary_token_start = false;
+                
+                switch (*it) {
+                    case '\n':
+                        if (depth == 0) {
+                            if (command_size(command, it) > max_command_size) {
+                                discard_command();
+                                current = state::plain;
+                            } else {
+                                dispatch(command, it);
+                            }
+                            command = it + 1;
+                        }
+                        boundary_token_start = true;
+                        break;
+                    case '"':
+                        if (token_start) {
+                            current = state::quoted;
+                        }
+                        break;
+                    case '{':
+                        if (token_start) {
+                            depth++;
+                            boundary_token_start = true;
+                        }
+                        break;
+                    case '}':
+                        if (depth > 0) {
+                            depth--;
+                            boundary_token_start = true;
+                        }
+                        break;
+                    default:
+                        break;
+                }
+            } else if (current == state::quoted) {
+                it = detail::scan<detail::char_class::escape>(it, last);
+                if (it == last) {
+                    break;
+                }
+                
+                if (*it == '"') {
+                    current = state::plain;
+                    boundary = it + 1;
+                    boundary_token_start = true;
+                } else {
+                    current = state::quoted_backslash;
+                }
+            } else {
+                // a backslash only escapes the quotation mark
+                current = *it == '\\' ? state::quoted_backslash : state::quoted;
+            }
+            
+            ++it;
+        }
+        
+        if (first != last) {
+            chunk_at_token_start = is_token_start(last, first, boundary, boundary_token_start);
+        }
+        
+        if (current != state::discarding && command_size(command, last) > max_command_size) {
+            discard_command();
+        }
+        
+        if (current != state::discarding) {
+            pending.insert(end(pending), command, last);
+        }
+        rethrow_error();
+    }
+    
+    void feed(std::string_view chunk)
+    {
+        chunk_copy.assign(begin(chunk), end(chunk));
+        feed(chunk_copy.data(), chunk_copy.data() + chunk_copy.size());
+    }
+    
+    // runs the last command when the input does not end with a newline
+    void finish()
+    {
+        if (!pending.empty()) {
+            auto line = std::move(pending);
+            pending.clear();
+            dispatch(line.data(), line.data() + line.size());
+        }
+        
+        current = state::plain;
+        depth = 0;
+        chunk_at_token_start = true;
+        rethrow_error();
+    }
+    
+    // whether a part of an unfinished command is buffered
+    bool has_partial_command() const
+    {
+        return !pending.empty();
+    }
+};
 
+}
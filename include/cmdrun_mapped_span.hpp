@@ -0,0 +1,120 @@
+#pragma once
+
+#include "cmdrun.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+namespace cmdrun {
+
+// Read-only view of a file mapped into memory as an array of T. As a command
+// argument it is given as the path of the file (quoted if it contains whitespace).
+// Copies share the mapping, it is released with the last one.
+template <typename T>
+class mapped_span
+{
+    static_assert(std::is_trivially_copyable_v<T>, "mapped files can only hold trivially copyable types");
+    static_assert(alignof(T) <= 4096, "mappings are only guaranteed to be page aligned");
+    
+    std::shared_ptr<const void> mapping;
+    const T* first = nullptr;
+    size_t count = 0;
+
+public:
+    mapped_span() = default;
+    
+    mapped_span(std::shared_ptr<const void> mapping_, size_t count_):
+        mapping{std::move(mapping_)}, first{static_cast<const T*>(mapping.get())}, count{count_} {}
+    
+    const T* data() const { return first; }
+    size_t size() const { return count; }
+    size_t size_bytes() const { return count * sizeof(T); }
+    bool empty() const { return count == 0; }
+    
+    const T* begin() const { return first; }
+    const T* end() const { return first + count; }
+    
+    const T& operator[](size_t i) const { return first[i]; }
+};
+
+namespace detail {
+
+[[noreturn]] inline void throw_mapping_error(const std::string& path, const char* reason)
+{
+    throw parsing_error("Unable to map '" + path + "' (" + reason + ")");
+}
+
+// maps the whole file read-only, an empty file results in a null mapping
+inline std::shared_ptr<const void> map_file(const std::string& path, size_t& size)
+{
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw_mapping_error(path, std::strerror(errno));
+    }
+    
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        const int error = errno;
+        close(fd);
+        throw_mapping_error(path, std::strerror(error));
+    }
+    
+    if (!S_ISREG(info.st_mode)) {
+        close(fd);
+        throw_mapping_error(path, "not a regular file");
+    }
+    
+    size = static_cast<size_t>(info.st_size);
+    if (size == 0) {
+        close(fd);
+        return nullptr;
+    }
+    
+    void* memory = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    const int error = errno;
+    close(fd);
+    
+    if (memory == MAP_FAILED) {
+        throw_mapping_error(path, std::strerror(error));
+    }
+    
+    return std::shared_ptr<const void>(memory, [size](const void* p) {
+        munmap(const_cast<void*>(p), size);
+    });
+}
+
+}
+
+template <typename T>
+struct parser<mapped_span<T>>
+{
+    static mapped_span<T> parse(input& in)
+    {
+        const auto path = std::string(parser<std::string_view>::parse(in));
+        
+        if (path.empty()) {
+            throw detail::parsing_error("Missing file name");
+        }
+        
+        size_t size = 0;
+        auto mapping = detail::map_file(path, size);
+        
+        if (size % sizeof(T) != 0) {
+            detail::throw_mapping_error(path, "size is not a multiple of the element size");
+        }
+        
+        // the whole file is mapped, so the elements start at a page boundary
+        return mapped_span<T>(std::move(mapping), size / sizeof(T));
+    }
+};
+
+}
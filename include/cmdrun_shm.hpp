@@ -0,0 +1,466 @@
+#pragma once
+
+#include "cmdrun.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+
+// Shared memory front end of a command_runner for processes on the same (Linux) machine.
+//
+// Clients reserve a ticket in a multi-producer ring of command lines, the server
+// runs them in ticket order and stores the outcome of each in a completion ring.
+// Both sides spin briefly and then sleep on a futex in the shared memory.
+
+namespace cmdrun {
+
+namespace detail {
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "shared memory rings need address-free atomics");
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex words must be plain 32 bit integers");
+
+inline constexpr uint32_t shm_magic = 0x636d6472;
+
+struct alignas(64) shm_header
+{
+    std::atomic<uint32_t> magic;
+    uint32_t capacity;
+    uint32_t line_size;
+    
+    alignas(64) std::atomic<uint32_t> tail;            // next ticket reserved by a client
+    alignas(64) std::atomic<uint32_t> submitted;       // futex word, bumped by every submission
+    std::atomic<uint32_t> server_waiting;
+    alignas(64) std::atomic<uint32_t> client_waiters;
+    alignas(64) std::atomic<uint32_t> released;        // futex word, bumped when slots are freed for waiting clients
+    std::atomic<uint32_t> submit_waiters;
+};
+
+// free for 'ticket' when sequence == ticket, holds its line when sequence == ticket + 1
+struct alignas(64) shm_submission
+{
+    std::atomic<uint32_t> sequence;
+    uint32_t length;
+};
+
+// futex word 'ticket' is shm_completed(ticket) once the outcome is stored, 0 while it is written
+struct alignas(64) shm_completion
+{
+    std::atomic<uint32_t> ticket;
+    int32_t status;
+    char message[56];
+};
+
+// ticket + 1, except for the last ticket before the wrap around, whose ticket + 1 would be 0
+inline uint32_t shm_completed(uint32_t ticket)
+{
+    return ticket + 1 != 0 ? ticket + 1 : 1;
+}
+
+inline size_t shm_submission_size(uint32_t line_size)
+{
+    return (sizeof(shm_submission) + line_size + 63) / 64 * 64;
+}
+
+inline size_t shm_size(uint32_t capacity, uint32_t line_size)
+{
+    return sizeof(shm_header) + capacity * (shm_submission_size(line_size) + sizeof(shm_completion));
+}
+
+inline void futex_wait(std::atomic<uint32_t>& word, uint32_t expected)
+{
+    // bounded, so that a lost wake up costs a little latency at worst
+    timespec timeout{0, 10'000'000};
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT, expected, &timeout, nullptr, 0);
+}
+
+inline void futex_wake(std::atomic<uint32_t>& word)
+{
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE, INT32_MAX, nullptr, nullptr, 0);
+}
+
+[[noreturn]] inline void throw_system_error(const char* what, int error = errno)
+{
+    throw std::system_error(error, std::generic_category(), what);
+}
+
+// maps a POSIX shared memory object and keeps pointers into the ring layout
+class shm_ring
+{
+    void* memory = MAP_FAILED;
+    size_t size = 0;
+
+protected:
+    shm_header* header = nullptr;
+    char* submissions = nullptr;
+    shm_completion* completions = nullptr;
+    
+    // private copies, the header is writable by every client
+    uint32_t capacity = 0;
+    uint32_t line_size = 0;
+    
+    void map(int fd, size_t size_)
+    {
+        size = size_;
+        memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        const int error = errno;
+        close(fd);
+        
+        if (memory == MAP_FAILED) {
+            throw_system_error("mmap", error);
+        }
+        
+        header = static_cast<shm_header*>(memory);
+    }
+    
+    void locate_rings(uint32_t capacity_, uint32_t line_size_)
+    {
+        capacity = capacity_;
+        line_size = line_size_;
+        submissions = reinterpret_cast<char*>(header + 1);
+        completions = reinterpret_cast<shm_completion*>(
+            submissions + capacity * shm_submission_size(line_size));
+    }
+    
+    uint32_t mask() const { return capacity - 1; }
+    
+    shm_submission& submission(uint32_t ticket) const
+    {
+        return *reinterpret_cast<shm_submission*>(
+            submissions + (ticket & mask()) * shm_submission_size(line_size));
+    }
+    
+    char* line(shm_submission& slot) const
+    {
+        return reinterpret_cast<char*>(&slot + 1);
+    }
+    
+    shm_completion& completion(uint32_t ticket) const
+    {
+        return completions[ticket & mask()];
+    }
+    
+    shm_ring() = default;
+    
+    ~shm_ring()
+    {
+        if (memory != MAP_FAILED) {
+            munmap(memory, size);
+        }
+    }
+
+public:
+    shm_ring(const shm_ring&) = delete;
+    shm_ring& operator=(const shm_ring&) = delete;
+};
+
+}
+
+enum class shm_status
+{
+    ok,
+    failed,     // the command threw, the message holds (the start of) what()
+    expired     // the client was too slow and the outcome was overwritten
+};
+
+struct shm_result
+{
+    shm_status status;
+    std::string message;
+};
+
+// Owns the shared memory object and runs the submitted commands.
+class shm_server : detail::shm_ring
+{
+    const command_runner& runner;
+    std::string name;
+    uint32_t head = 0;
+    
+    void complete(uint32_t ticket, shm_status status, const char* message)
+    {
+        auto& entry = completion(ticket);
+        
+        // seqlock style, a reader of an older ticket sees 0 and gives up
+        entry.ticket.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        
+        entry.status = static_cast<int32_t>(status);
+        std::strncpy(entry.message, message, sizeof(entry.message) - 1);
+        entry.message[sizeof(entry.message) - 1] = '\0';
+        
+        entry.ticket.store(detail::shm_completed(ticket), std::memory_order_seq_cst);
+    }
+
+public:
+    // Capacity is rounded up to a power of two, line_size is the longest accepted command line.
+    // Tickets are counted from first_ticket and wrap around. Fails with EEXIST while the
+    // name is in use, a leftover of a crashed server has to be removed with shm_unlink.
+    shm_server(const command_runner& runner_, const std::string& name_,
+               uint32_t capacity_ = 1024, uint32_t line_size_ = 256, uint32_t first_ticket = 0):
+        runner{runner_}, name{name_}, head{first_ticket}
+    {
+        // at least two slots, the last ticket before the wrap around and the first one after must not share one
+        const auto rounded = detail::round_up_pow2(std::max<uint32_t>(capacity_, 2));
+        
+        const auto ring_size = detail::shm_size(rounded, line_size_);
+        
+        const int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd < 0) {
+            detail::throw_system_error("shm_open");
+        }
+        
+        if (ftruncate(fd, static_cast<off_t>(ring_size)) != 0) {
+            const int error = errno;
+            close(fd);
+            shm_unlink(name.c_str());
+            detail::throw_system_error("ftruncate", error);
+        }
+        
+        map(fd, ring_size);
+        
+        header->capacity = rounded;
+        header->line_size = line_size_;
+        locate_rings(rounded, line_size_);
+        
+        header->tail.store(first_ticket, std::memory_order_relaxed);
+        for (uint32_t i = 0; i < rounded; i++) {
+            submission(first_ticket + i).sequence.store(first_ticket + i, std::memory_order_relaxed);
+        }
+        
+        // published last, clients refuse to attach before
+        header->magic.store(detail::shm_magic, std::memory_order_release);
+    }
+    
+    ~shm_server()
+    {
+        shm_unlink(name.c_str());
+    }
+    
+    // runs up to max_batch submitted commands, returns how many ran
+    size_t drain(size_t max_batch = 64)
+    {
+        const uint32_t first = head;
+        
+        for (size_t n = 0; n < max_batch; n++) {
+            auto& slot = submission(head);
+            
+            if (slot.sequence.load(std::memory_order_acquire) != head + 1) {
+                break;
+            }
+            
+            char* const command_line = line(slot);
+            const uint32_t length = slot.length;
+            
+            try {
+                if (length > line_size) {
+                    throw std::length_error("Command line does not fit into a shared memory slot");
+                }
+                
+                runner.run_in_place(command_line, command_line + length);
+                complete(head, shm_status::ok, "");
+            } catch (const std::exception& e) {
+                complete(head, shm_status::failed, e.what());
+            } catch (...) {
+                complete(head, shm_status::failed, "unknown exception");
+            }
+            
+            slot.sequence.store(head + capacity, std::memory_order_release);
+            head++;
+        }
+        
+        // pairs with the waiter registration of clients, either the server sees a waiter or it sees the freed slot
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        
+        if (head != first && header->submit_waiters.load(std::memory_order_relaxed) > 0) {
+            header->released.fetch_add(1, std::memory_order_release);
+            detail::futex_wake(header->released);
+        }
+        
+        if (header->client_waiters.load(std::memory_order_seq_cst) > 0) {
+            for (uint32_t ticket = first; ticket != head; ticket++) {
+                detail::futex_wake(completion(ticket).ticket);
+            }
+        }
+        
+        return head - first;
+    }
+    
+    // drains the ring until 'stop' is set, sleeping while it is empty
+    void serve(const std::atomic<bool>& stop, size_t max_batch = 64)
+    {
+        while (!stop.load(std::memory_order_relaxed)) {
+            const auto observed = header->submitted.load(std::memory_order_seq_cst);
+            
+            if (drain(max_batch) > 0) {
+                continue;
+            }
+            
+            header->server_waiting.store(1, std::memory_order_seq_cst);
+            detail::futex_wait(header->submitted, observed);
+            header->server_waiting.store(0, std::memory_order_relaxed);
+        }
+    }
+    
+    // wakes a server sleeping in serve(), e.g. after setting its stop flag
+    void notify()
+    {
+        header->submitted.fetch_add(1, std::memory_order_seq_cst);
+        detail::futex_wake(header->submitted);
+    }
+};
+
+// Attaches to the shared memory object of a running shm_server.
+class shm_client : detail::shm_ring
+{
+    static constexpr int spin_count = 1000;
+    
+    // sleeps until the server frees slots, unless it freed 'slot' in the meantime
+    void wait_for_release(detail::shm_submission& slot, uint32_t sequence)
+    {
+        header->submit_waiters.fetch_add(1, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        
+        const auto observed = header->released.load(std::memory_order_acquire);
+        if (slot.sequence.load(std::memory_order_relaxed) == sequence) {
+            detail::futex_wait(header->released, observed);
+        }
+        
+        header->submit_waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+public:
+    explicit shm_client(const std::string& name)
+    {
+        const int fd = shm_open(name.c_str(), O_RDWR, 0);
+        if (fd < 0) {
+            detail::throw_system_error("shm_open");
+        }
+        
+        struct stat info;
+        if (fstat(fd, &info) != 0) {
+            const int error = errno;
+            close(fd);
+            detail::throw_system_error("fstat", error);
+        }
+        
+        if (static_cast<size_t>(info.st_size) < sizeof(detail::shm_header)) {
+            close(fd);
+            throw std::runtime_error("Shared memory command ring is not initialized");
+        }
+        
+        map(fd, static_cast<size_t>(info.st_size));
+        
+        if (header->magic.load(std::memory_order_acquire) != detail::shm_magic) {
+            throw std::runtime_error("Shared memory command ring is not initialized");
+        }
+        
+        const auto capacity_ = header->capacity;
+        const auto line_size_ = header->line_size;
+        
+        if (capacity_ == 0 || (capacity_ & (capacity_ - 1)) != 0
+                || detail::shm_size(capacity_, line_size_) > static_cast<size_t>(info.st_size)) {
+            throw std::runtime_error("Shared memory command ring is corrupted");
+        }
+        
+        locate_rings(capacity_, line_size_);
+    }
+    
+    // queues a command line and returns its ticket, waits while the ring is full
+    uint32_t submit(std::string_view command_line)
+    {
+        if (command_line.size() > line_size) {
+            throw std::length_error("Command line does not fit into a shared memory slot");
+        }
+        
+        auto ticket = header->tail.load(std::memory_order_relaxed);
+        
+        for (int spins = 0;;) {
+            auto& slot = submission(ticket);
+            const auto sequence = slot.sequence.load(std::memory_order_acquire);
+            const auto ahead = static_cast<int32_t>(sequence - ticket);
+            
+            if (ahead == 0) {
+                if (header->tail.compare_exchange_weak(ticket, ticket + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else {
+                // the ring is full
+                if (ahead < 0 && ++spins > spin_count) {
+                    wait_for_release(slot, sequence);
+                }
+                ticket = header->tail.load(std::memory_order_relaxed);
+            }
+        }
+        
+        auto& slot = submission(ticket);
+        std::memcpy(line(slot), command_line.data(), command_line.size());
+        slot.length = static_cast<uint32_t>(command_line.size());
+        slot.sequence.store(ticket + 1, std::memory_order_release);
+        
+        header->submitted.fetch_add(1, std::memory_order_seq_cst);
+        if (header->server_waiting.load(std::memory_order_seq_cst) != 0) {
+            detail::futex_wake(header->submitted);
+        }
+        
+        return ticket;
+    }
+    
+    // waits for the outcome of a submitted command
+    shm_result wait(uint32_t ticket)
+    {
+        auto& entry = completion(ticket);
+        const uint32_t done = detail::shm_completed(ticket);
+        
+        for (int spins = 0;; spins++) {
+            const auto observed = entry.ticket.load(std::memory_order_acquire);
+            
+            if (observed == done) {
+                const auto status = static_cast<shm_status>(entry.status);
+                char message[sizeof(entry.message)];
+                std::memcpy(message, entry.message, sizeof(message));
+                
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (entry.ticket.load(std::memory_order_relaxed) != done) {
+                    return {shm_status::expired, {}};
+                }
+                
+                message[sizeof(message) - 1] = '\0';
+                return {status, message};
+            }
+            
+            if (observed != 0 && static_cast<int32_t>(observed - done) > 0) {
+                return {shm_status::expired, {}};
+            }
+            
+            if (spins < spin_count) {
+                continue;
+            }
+            
+            header->client_waiters.fetch_add(1, std::memory_order_seq_cst);
+            if (entry.ticket.load(std::memory_order_seq_cst) == observed) {
+                detail::futex_wait(entry.ticket, observed);
+            }
+            header->client_waiters.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+    
+    shm_result run(std::string_view command_line)
+    {
+        return wait(submit(command_line));
+    }
+};
+
+}
@@ -332,3 +332,205 @@ TEST_CASE("can parse associative containers")
         CHECK(multimap.count(3) == 2);
     }
 }
+
+TEST_CASE("can parse numbers")
+{
+    SECTION("integers and floating point numbers")
+    {
+        std::istringstream iss(" 42 -7 +3 2.5 1e3 +.5");
+        CHECK(parse<int>(iss) == 42);
+        CHECK(parse<long>(iss) == -7);
+        CHECK(parse<unsigned>(iss) == 3u);
+        CHECK(parse<float>(iss) == Approx(2.5f));
+        CHECK(parse<double>(iss) == Approx(1000.0));
+        CHECK(parse<double>(iss) == Approx(0.5));
+    }
+    
+    SECTION("malformed numbers result in an exception")
+    {
+        std::istringstream iss("abc");
+        REQUIRE_THROWS_AS(parse<int>(iss), parsing_error);
+        
+        iss = std::istringstream("-1");
+        REQUIRE_THROWS_AS(parse<unsigned>(iss), parsing_error);
+        
+        iss = std::istringstream("70000");
+        REQUIRE_THROWS_AS(parse<short>(iss), parsing_error);
+        
+        iss = std::istringstream("");
+        REQUIRE_THROWS_AS(parse<double>(iss), parsing_error);
+        
+        iss = std::istringstream("+-5");
+        REQUIRE_THROWS_AS(parse<int>(iss), parsing_error);
+        
+        iss = std::istringstream("+-5");
+        REQUIRE_THROWS_AS(parse<double>(iss), parsing_error);
+        
+        iss = std::istringstream("+");
+        REQUIRE_THROWS_AS(parse<int>(iss), parsing_error);
+    }
+}
+
+TEST_CASE("can parse string views in place")
+{
+    std::string line = R"(word "two \"words\"" {a, "b c"} rest)";
+    cmdrun::input in(line.data(), line.data() + line.size());
+    
+    CHECK(parse<std::string_view>(in) == "word");
+    CHECK(parse<std::string_view>(in) == R"(two "words")");
+    CHECK(parse<std::vector<std::string_view>>(in) == std::vector<std::string_view>{"a", "b c"});
+    CHECK(parse<std::string_view>(in) == "rest");
+    
+    const auto inside_line = [&](std::string_view view) {
+        return view.data() >= line.data() && view.data() + view.size() <= line.data() + line.size();
+    };
+    
+    std::string other = R"("quoted")";
+    cmdrun::input other_in(other.data(), other.data() + other.size());
+    CHECK_FALSE(inside_line(parse<std::string_view>(other_in)));
+    
+    cmdrun::input again(line.data(), line.data() + line.size());
+    CHECK(inside_line(parse<std::string_view>(again)));
+}
+
+namespace {
+
+struct price
+{
+    long ticks;
+};
+
+struct point
+{
+    int x, y;
+};
+
+std::istream& operator>>(std::istream& is, point& p)
+{
+    char sep = 0;
+    return is >> p.x >> sep >> p.y;
+}
+
+}
+
+// fixed-point price with four decimal places, e.g. '12.3456'
+template <>
+struct cmdrun::parser<price>
+{
+    static price parse(cmdrun::input& in)
+    {
+        const auto whole = cmdrun::parser<long>::parse(in);
+        long fraction = 0;
+        int digits = 0;
+        
+        if (!in.empty() && in.peek() == '.') {
+            in.get();
+            for (; digits < 4 && !in.empty() && std::isdigit(static_cast<unsigned char>(in.peek())); digits++) {
+                fraction = fraction * 10 + (in.get() - '0');
+            }
+        }
+        
+        for (; digits < 4; digits++) {
+            fraction *= 10;
+        }
+        
+        return price{whole * 10000 + fraction};
+    }
+};
+
+TEST_CASE("can parse user types")
+{
+    SECTION("through a parser specialization")
+    {
+        std::istringstream iss("12.34 {1, 2.5}");
+        CHECK(parse<price>(iss).ticks == 123400);
+        
+        auto prices = parse<std::vector<price>>(iss);
+        REQUIRE(prices.size() == 2);
+        CHECK(prices[0].ticks == 10000);
+        CHECK(prices[1].ticks == 25000);
+    }
+    
+    SECTION("through a stream extraction operator")
+    {
+        std::istringstream iss("3;4 {5;6, 7;8}");
+        auto p = parse<point>(iss);
+        CHECK(p.x == 3);
+        CHECK(p.y == 4);
+        
+        auto points = parse<std::vector<point>>(iss);
+        REQUIRE(points.size() == 2);
+        CHECK(points[1].x == 7);
+        CHECK(points[1].y == 8);
+    }
+    
+    SECTION("through a stream extraction operator in long sequences")
+    {
+        std::string line = "{0;0";
+        for (int i = 1; i < 32768; i++) {
+            line += ", " + std::to_string(i) + ";" + std::to_string(-i);
+        }
+        line += "}";
+        
+        cmdrun::input in(line.data(), line.data() + line.size());
+        auto points = parse<std::vector<point>>(in);
+        
+        REQUIRE(points.size() == 32768);
+        CHECK(points.back().x == 32767);
+        CHECK(points.back().y == -32767);
+        CHECK(in.empty());
+    }
+}
+
+template <char_class Class>
+void check_scan(const std::string& text)
+{
+    for (size_t first = 0; first < text.size(); first++) {
+        const auto expected = std::find_if(text.data() + first, text.data() + text.size(), matches<Class>);
+        CHECK(scan<Class>(text.data() + first, text.data() + text.size()) == expected);
+    }
+}
+
+TEST_CASE("scanning finds the same characters as a byte by byte search")
+{
+    const std::string alphabet = "ab, }{\"\\\t\n\r\v\fz\x80\xff";
+    
+    for (size_t length : {1u, 15u, 16u, 17u, 31u, 32u, 33u, 64u, 100u}) {
+        for (size_t seed = 0; seed < alphabet.size(); seed++) {
+            // mostly plain characters with a single structural one at varying positions
+            std::string text(length, 'x');
+            text[(seed * 7) % length] = alphabet[seed];
+            
+            check_scan<char_class::space>(text);
+            check_scan<char_class::not_space>(text);
+            check_scan<char_class::delimiter>(text);
+            check_scan<char_class::escape>(text);
+            check_scan<char_class::line_structure>(text);
+            
+            std::string spaces(length, ' ');
+            spaces[(seed * 5) % length] = alphabet[seed];
+            check_scan<char_class::not_space>(spaces);
+        }
+    }
+}
+
+TEST_CASE("can parse long strings")
+{
+    std::string payload;
+    for (int i = 0; i < 50; i++) {
+        payload += "some text with \\\"escaped\\\" quotes and c:\\paths ";
+    }
+    
+    std::string expected;
+    for (int i = 0; i < 50; i++) {
+        expected += R"(some text with "escaped" quotes and c:\paths )";
+    }
+    
+    std::istringstream iss("\"" + payload + "\"");
+    CHECK(parse<std::string>(iss) == expected);
+    
+    const std::string word(100, 'w');
+    iss = std::istringstream("{" + word + ", " + word + "}" + std::string(40, ' ') + word);
+    CHECK(parse<std::vector<std::string>>(iss) == std::vector<std::string>{word, word});
+    CHECK(parse<std::string>(iss) == word);
+}
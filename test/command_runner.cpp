@@ -1,6 +1,9 @@
 #include <catch2/catch.hpp>
 #include "cmdrun.hpp"
 
+#include <chrono>
+#include <ctime>
+
 #define ARGV_SIZE(argv) (sizeof(argv)/sizeof(*argv))
 
 using namespace cmdrun;
@@ -20,6 +23,29 @@ TEST_CASE("can run a simple command")
     REQUIRE(executed == true);
 }
 
+TEST_CASE("stateful callables keep their state between commands")
+{
+    int seen = 0;
+    auto cp = command_runner(command{"tick", [n = 0, &seen]() mutable { seen = ++n; }});
+    
+    SECTION("run one by one")
+    {
+        cp.run("tick");
+        cp.run("tick");
+        cp.run("tick");
+        
+        REQUIRE(seen == 3);
+    }
+    
+    SECTION("run in a pipeline")
+    {
+        std::istringstream script("tick\ntick\ntick\n");
+        cp.run_pipelined(script);
+        
+        REQUIRE(seen == 3);
+    }
+}
+
 TEST_CASE("can run command with an argument")
 {
     SECTION("integer argument")
@@ -120,3 +146,363 @@ TEST_CASE("command line parameters may contain whitespace characters")
     
     CHECK(arg == "a b\tc");
 }
+
+TEST_CASE("can run a stream of commands in a pipeline")
+{
+    std::vector<int> executed;
+    auto cp = command_runner({
+        command{"add", [&](int a) { executed.push_back(a); }},
+        command{"add_all", [&](std::vector<int> v) { executed.insert(end(executed), begin(v), end(v)); }},
+        command{"fail", [&]() { throw std::runtime_error("fail"); }}
+    });
+    
+    SECTION("commands are executed in input order")
+    {
+        std::ostringstream script;
+        for (int i=0; i<1000; i++) {
+            script << "add " << i << '\n';
+        }
+        
+        std::istringstream input(script.str());
+        cp.run_pipelined(input, 4);
+        
+        REQUIRE(executed.size() == 1000);
+        for (int i=0; i<1000; i++) {
+            CHECK(executed[static_cast<size_t>(i)] == i);
+        }
+    }
+    
+    SECTION("empty lines and unknown commands are skipped")
+    {
+        std::istringstream input("add 1\n\nunknown 5\nadd 2");
+        cp.run_pipelined(input);
+        
+        CHECK(executed == std::vector<int>{1, 2});
+    }
+    
+    SECTION("parsing errors are reported after preceding commands run")
+    {
+        std::istringstream input("add 1\nadd_all {2, 3}\nadd_all {\nadd 4");
+        REQUIRE_THROWS_AS(cp.run_pipelined(input), detail::parsing_error);
+        
+        CHECK(executed == std::vector<int>{1, 2, 3});
+    }
+    
+    SECTION("exceptions thrown by commands stop the pipeline")
+    {
+        std::istringstream input("add 1\nfail\nadd 2");
+        REQUIRE_THROWS_AS(cp.run_pipelined(input, 2), std::runtime_error);
+        
+        CHECK(executed == std::vector<int>{1});
+    }
+    
+    SECTION("the executing thread sleeps while the input blocks")
+    {
+        // delivers a single line after a delay, like a slow pipe
+        struct slow_buffer : std::streambuf
+        {
+            char line[6] = {'a', 'd', 'd', ' ', '7', '\n'};
+            bool delivered = false;
+            
+            int_type underflow() override
+            {
+                if (delivered) {
+                    return traits_type::eof();
+                }
+                
+                std::this_thread::sleep_for(std::chrono::milliseconds(200));
+                delivered = true;
+                setg(line, line, line + sizeof(line));
+                return traits_type::to_int_type(line[0]);
+            }
+        };
+        
+        slow_buffer buffer;
+        std::istream input(&buffer);
+        
+        const auto cpu_start = std::clock();
+        cp.run_pipelined(input);
+        const auto cpu_ms = static_cast<double>(std::clock() - cpu_start) * 1000 / CLOCKS_PER_SEC;
+        
+        CHECK(executed == std::vector<int>{7});
+        CHECK(cpu_ms < 100);
+    }
+}
+
+TEST_CASE("can run commands with string view arguments")
+{
+    std::string arg_a, arg_b;
+    auto cp = command_runner(command{"cmd",
+        [&](std::string_view a, std::string_view b) {
+            arg_a = a;
+            arg_b = b;
+        }});
+    
+    cp.run(R"(cmd first "second \"quoted\" argument")");
+    CHECK(arg_a == "first");
+    CHECK(arg_b == R"(second "quoted" argument)");
+    
+    const auto long_word = std::string(1000, 'x');
+    cp.run("cmd " + long_word + " y");
+    CHECK(arg_a == long_word);
+    CHECK(arg_b == "y");
+}
+
+TEST_CASE("can change commands of a runner")
+{
+    std::string executed;
+    auto cp = command_runner(command{"a", [&]() { executed += 'a'; }});
+    
+    cp.add_command(command{"b", [&]() { executed += 'b'; }});
+    cp.run("a");
+    cp.run("b");
+    CHECK(executed == "ab");
+    
+    cp.add_command(command{"a", [&]() { executed += 'A'; }});
+    cp.run("a");
+    CHECK(executed == "abA");
+    
+    cp.remove_command("b");
+    cp.run("b");
+    CHECK(executed == "abA");
+    
+    cp.set_commands({command{"c", [&]() { executed += 'c'; }}});
+    cp.run("a");
+    cp.run("c");
+    CHECK(executed == "abAc");
+}
+
+TEST_CASE("commands can be reloaded from a command")
+{
+    int version = 0;
+    auto cp = command_runner();
+    
+    cp.add_command(command{"reload", [&](int v) {
+        cp.add_command(command{"version", [&version, v]() { version = v; }});
+    }});
+    
+    cp.run("reload 1");
+    cp.run("version");
+    CHECK(version == 1);
+    
+    cp.run("reload 2");
+    cp.run("version");
+    CHECK(version == 2);
+}
+
+TEST_CASE("commands can be reloaded from a command in a pipeline")
+{
+    std::vector<std::string> executed;
+    auto cp = command_runner();
+    
+    cp.add_command(command{"reload", [&](int v) {
+        cp.add_command(command{"version", [&executed, v]() { executed.push_back(std::to_string(v)); }});
+        cp.add_command(command{"say", [&executed, v](std::vector<int> args) {
+            executed.push_back(std::to_string(v) + ":" + std::to_string(args.size()));
+        }});
+    }});
+    cp.add_command(command{"say", [&executed](int a) { executed.push_back("say " + std::to_string(a)); }});
+    
+    SECTION("added commands are not skipped")
+    {
+        for (int i = 0; i < 200; i++) {
+            executed.clear();
+            cp.remove_command("version");
+            
+            std::istringstream script("reload 1\nversion\n");
+            cp.run_pipelined(script);
+            
+            REQUIRE(executed == std::vector<std::string>{"1"});
+        }
+    }
+    
+    SECTION("lines parsed ahead are parsed again for replaced commands")
+    {
+        std::istringstream script("say 5\nreload 2\nsay {1, 2}\nversion\n");
+        cp.run_pipelined(script);
+        
+        CHECK(executed == std::vector<std::string>{"say 5", "2:2", "2"});
+    }
+}
+
+TEST_CASE("commands can be replaced while other threads run them")
+{
+    std::atomic<int> executed{0};
+    auto cp = command_runner(command{"cmd", [&](int) { executed++; }});
+    
+    std::atomic<bool> stop{false};
+    std::vector<std::thread> runners;
+    
+    for (int i = 0; i < 4; i++) {
+        runners.emplace_back([&]() {
+            while (!stop) {
+                cp.run("cmd 1");
+            }
+        });
+    }
+    
+    for (int i = 0; i < 200 || executed < 1000; i++) {
+        cp.set_commands({
+            command{"cmd", [&executed, i](int) { executed += i % 2 ? 1 : 2; }},
+            command{"other" + std::to_string(i), []() {}}
+        });
+    }
+    
+    stop = true;
+    for (auto& runner : runners) {
+        runner.join();
+    }
+    
+    CHECK(executed >= 1000);
+}
+
+TEST_CASE("can run commands from input arriving in chunks")
+{
+    std::vector<std::string> executed;
+    auto cp = command_runner({
+        command{"say", [&](std::string a) { executed.push_back(a); }},
+        command{"sum", [&](std::vector<int> v) {
+            int sum = 0;
+            for (auto x : v) {
+                sum += x;
+            }
+            executed.push_back(std::to_string(sum));
+        }},
+        command{"two", [&](std::vector<int> v, std::string a) { executed.push_back(std::to_string(v.size()) + a); }},
+        command{"fail", [&]() { throw std::runtime_error("fail"); }}
+    });
+    
+    // split where the argument parsers would split the same lines
+    const std::string script = "say hello\n"
+        "say \"multi\nline \\\"quoted\\\" {string}\"\n"
+        "sum {1, 2,\n 3}\n"
+        "\n"
+        "say a\"b\n"
+        "sum {1, x}\n"
+        "say x,{\n"
+        "say next\n"
+        "two {1}\"a\nb\"\n"
+        "say last";
+    
+    const std::vector<std::string> expected = {
+        "hello", "multi\nline \"quoted\" {string}", "6", "a\"b", "x,{", "next", "1a\nb", "last"
+    };
+    
+    SECTION("in a single chunk")
+    {
+        push_parser parser(cp);
+        CHECK_THROWS_AS(parser.feed(script), detail::parsing_error);
+        CHECK(parser.has_partial_command());
+        parser.finish();
+        
+        CHECK(executed == expected);
+    }
+    
+    SECTION("split at every position")
+    {
+        for (size_t split = 0; split <= script.size(); split++) {
+            executed.clear();
+            push_parser parser(cp);
+            
+            try {
+                parser.feed(script.substr(0, split));
+            } catch (const detail::parsing_error&) {}
+            
+            try {
+                parser.feed(script.substr(split));
+            } catch (const detail::parsing_error&) {}
+            
+            parser.finish();
+            CHECK(executed == expected);
+        }
+    }
+    
+    SECTION("byte by byte")
+    {
+        push_parser parser(cp);
+        
+        for (char c : script) {
+            try {
+                parser.feed(std::string_view(&c, 1));
+            } catch (const detail::parsing_error&) {}
+        }
+        
+        parser.finish();
+        CHECK(executed == expected);
+    }
+    
+    SECTION("commands after a failing one still run")
+    {
+        push_parser parser(cp);
+        CHECK_THROWS_AS(parser.feed("say a\nfail\nsay b\n"), std::runtime_error);
+        
+        CHECK(executed == std::vector<std::string>{"a", "b"});
+    }
+    
+    SECTION("unterminated commands are dropped once they exceed the maximum size")
+    {
+        for (std::string start : {"say \"unterminated\n", "say {\n"}) {
+            executed.clear();
+            push_parser parser(cp, 64);
+            parser.feed("say a\n" + start);
+            
+            bool failed = false;
+            for (int i = 0; i < 100 && !failed; i++) {
+                try {
+                    parser.feed("say b\n");
+                } catch (const detail::parsing_error&) {
+                    failed = true;
+                }
+            }
+            
+            CHECK(failed);
+            CHECK_FALSE(parser.has_partial_command());
+            
+            // the rest of the dropped command is skipped up to the next newline
+            parser.feed("say c\nsay d\n");
+            CHECK(executed == std::vector<std::string>{"a", "d"});
+        }
+    }
+    
+    SECTION("huge commands are accepted by default")
+    {
+        std::string line = "sum {0";
+        for (int i = 1; i < 200000; i++) {
+            line += ", " + std::to_string(i % 10);
+        }
+        line += "}\n";
+        REQUIRE(line.size() > 500 * 1024);
+        
+        push_parser parser(cp);
+        for (size_t pos = 0; pos < line.size(); pos += 4096) {
+            parser.feed(std::string_view(line).substr(pos, 4096));
+        }
+        
+        CHECK(executed == std::vector<std::string>{"900000"});
+    }
+    
+    SECTION("complete commands exceeding the maximum size fail")
+    {
+        push_parser parser(cp, 16);
+        CHECK_THROWS_AS(parser.feed("say " + std::string(20, 'x') + "\nsay b\n"), detail::parsing_error);
+        
+        CHECK(executed == std::vector<std::string>{"b"});
+    }
+}
+
+TEST_CASE("commands within a single chunk are parsed in place")
+{
+    std::string_view arg;
+    auto cp = command_runner(command{"cmd", [&](std::string_view a) { arg = a; }});
+    push_parser parser(cp);
+    
+    std::string chunk = "cmd first\ncmd sec";
+    parser.feed(chunk.data(), chunk.data() + chunk.size());
+    CHECK(arg == "first");
+    CHECK(arg.data() == chunk.data() + 4);
+    
+    std::string rest = "ond\n";
+    parser.feed(rest.data(), rest.data() + rest.size());
+    CHECK(arg.data() != rest.data());
+    CHECK_FALSE(parser.has_partial_command());
+}
@@ -0,0 +1,113 @@
+#include <catch2/catch.hpp>
+#include "cmdrun_mapped_span.hpp"
+
+#include <cstdio>
+#include <numeric>
+
+using namespace cmdrun;
+
+namespace {
+
+// a temporary file removed at the end of the test
+struct temporary_file
+{
+    std::string path;
+    
+    explicit temporary_file(const std::string& content, const std::string& suffix = "")
+    {
+        char name[] = "/tmp/cmdrun_mapped_XXXXXX";
+        const int fd = mkstemp(name);
+        REQUIRE(fd >= 0);
+        REQUIRE(write(fd, content.data(), content.size()) == static_cast<ssize_t>(content.size()));
+        close(fd);
+        
+        path = name + suffix;
+        if (!suffix.empty()) {
+            REQUIRE(std::rename(name, path.c_str()) == 0);
+        }
+    }
+    
+    ~temporary_file()
+    {
+        std::remove(path.c_str());
+    }
+};
+
+template <typename T>
+std::string bytes_of(const std::vector<T>& values)
+{
+    return std::string(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(T));
+}
+
+}
+
+TEST_CASE("can pass memory mapped files as arguments")
+{
+    std::vector<float> values(10000);
+    std::iota(begin(values), end(values), 0.0f);
+    temporary_file file(bytes_of(values));
+    
+    double sum = 0;
+    size_t count = 0;
+    auto cp = command_runner(command{"sum", [&](mapped_span<float> data) {
+        sum = std::accumulate(data.begin(), data.end(), 0.0);
+        count = data.size();
+    }});
+    
+    SECTION("the span covers the whole file")
+    {
+        cp.run("sum " + file.path);
+        CHECK(count == values.size());
+        CHECK(sum == Approx(std::accumulate(begin(values), end(values), 0.0)));
+    }
+    
+    SECTION("file names may be quoted")
+    {
+        temporary_file spaced(bytes_of(values), " with spaces");
+        cp.run("sum \"" + spaced.path + "\"");
+        CHECK(count == values.size());
+    }
+    
+    SECTION("empty files result in empty spans")
+    {
+        temporary_file empty("");
+        count = 1;
+        cp.run("sum " + empty.path);
+        CHECK(count == 0);
+    }
+}
+
+TEST_CASE("invalid mapped files result in an exception")
+{
+    auto cp = command_runner(command{"cmd", [](mapped_span<int32_t>) {}});
+    
+    SECTION("missing files")
+    {
+        CHECK_THROWS_AS(cp.run("cmd /nonexistent/file"), detail::parsing_error);
+        CHECK_THROWS_AS(cp.run("cmd"), detail::parsing_error);
+    }
+    
+    SECTION("directories")
+    {
+        CHECK_THROWS_AS(cp.run("cmd /tmp"), detail::parsing_error);
+    }
+    
+    SECTION("sizes which are not a multiple of the element size")
+    {
+        temporary_file file("12345");
+        CHECK_THROWS_AS(cp.run("cmd " + file.path), detail::parsing_error);
+    }
+}
+
+TEST_CASE("mapping outlives the command line when the span is kept")
+{
+    std::vector<int> values = {1, 2, 3};
+    temporary_file file(bytes_of(values));
+    
+    mapped_span<int> kept;
+    auto cp = command_runner(command{"keep", [&](mapped_span<int> data) { kept = data; }});
+    cp.run("keep " + file.path);
+    
+    REQUIRE(kept.size() == 3);
+    CHECK(kept[2] == 3);
+}
@@ -0,0 +1,264 @@
+#include <catch2/catch.hpp>
+#include "cmdrun_shm.hpp"
+
+#include <chrono>
+#include <future>
+
+#include <sys/wait.h>
+
+using namespace cmdrun;
+
+namespace {
+
+std::string ring_name()
+{
+    return "/cmdrun_test_" + std::to_string(getpid());
+}
+
+}
+
+TEST_CASE("can run commands through a shared memory ring")
+{
+    std::vector<int> executed;
+    auto cr = command_runner({
+        command{"add", [&](int a) { executed.push_back(a); }},
+        command{"fail", [&]() { throw std::runtime_error("command failed"); }}
+    });
+    
+    shm_server server(cr, ring_name(), 8, 64);
+    std::atomic<bool> stop{false};
+    std::thread serving([&]() { server.serve(stop); });
+    
+    shm_client client(ring_name());
+    
+    SECTION("outcome of every command is reported")
+    {
+        auto result = client.run("add 1");
+        CHECK(result.status == shm_status::ok);
+        
+        result = client.run("fail");
+        CHECK(result.status == shm_status::failed);
+        CHECK(result.message == "command failed");
+        
+        result = client.run("add {");
+        CHECK(result.status == shm_status::failed);
+    }
+    
+    SECTION("commands too long for a slot are rejected")
+    {
+        CHECK_THROWS_AS(client.submit("add " + std::string(100, '1')), std::length_error);
+    }
+    
+    SECTION("submissions of one client are run in order")
+    {
+        std::vector<uint32_t> tickets;
+        for (int i = 0; i < 100; i++) {
+            tickets.push_back(client.submit("add " + std::to_string(i)));
+        }
+        
+        CHECK(client.wait(tickets.back()).status == shm_status::ok);
+    }
+    
+    stop = true;
+    server.notify();
+    serving.join();
+    
+    for (size_t i = 1; i < executed.size(); i++) {
+        CHECK(executed[i - 1] < executed[i]);
+    }
+}
+
+TEST_CASE("tickets can wrap around")
+{
+    std::vector<int> executed;
+    auto cr = command_runner({
+        command{"add", [&](int a) { executed.push_back(a); }},
+        command{"fail", [&]() { throw std::runtime_error("command failed"); }}
+    });
+    
+    shm_server server(cr, ring_name(), 8, 64, UINT32_MAX - 2);
+    shm_client client(ring_name());
+    
+    auto run = [&](const std::string& command_line) {
+        const auto ticket = client.submit(command_line);
+        server.drain();
+        return client.wait(ticket);
+    };
+    
+    CHECK(run("add 1").status == shm_status::ok);
+    CHECK(run("add 2").status == shm_status::ok);
+    
+    // the last ticket before the wrap around, its outcome must not be mistaken for one being written
+    const auto ticket = client.submit("fail");
+    REQUIRE(ticket == UINT32_MAX);
+    
+    auto waiting = std::async(std::launch::async, [&]() { return client.wait(ticket); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    server.drain();
+    
+    const auto result = waiting.get();
+    CHECK(result.status == shm_status::failed);
+    CHECK(result.message == "command failed");
+    
+    for (int i = 3; i < 20; i++) {
+        CHECK(run("add " + std::to_string(i)).status == shm_status::ok);
+    }
+    
+    CHECK(executed.size() == 19);
+}
+
+TEST_CASE("clients sleep while the ring is full")
+{
+    int executed = 0;
+    auto cr = command_runner(command{"cmd", [&]() { executed++; }});
+    shm_server server(cr, ring_name(), 2, 64);
+    
+    double cpu_ms = 0;
+    std::thread submitting([&]() {
+        shm_client client(ring_name());
+        
+        timespec start{}, end{};
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+        for (int i = 0; i < 4; i++) {
+            client.submit("cmd");
+        }
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+        
+        cpu_ms = static_cast<double>(end.tv_sec - start.tv_sec) * 1000
+            + static_cast<double>(end.tv_nsec - start.tv_nsec) / 1'000'000;
+    });
+    
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    while (executed < 4) {
+        server.drain();
+    }
+    submitting.join();
+    
+    CHECK(cpu_ms < 100);
+}
+
+TEST_CASE("the server does not trust the shared memory")
+{
+    int executed = 0;
+    auto cr = command_runner(command{"cmd", [&]() { executed++; }});
+    shm_server server(cr, ring_name(), 8, 64);
+    
+    SECTION("a running server keeps its name")
+    {
+        try {
+            shm_server other(cr, ring_name());
+            FAIL("a second server took over the name");
+        } catch (const std::system_error& e) {
+            CHECK(e.code().value() == EEXIST);
+        }
+        
+        shm_client client(ring_name());
+        const auto ticket = client.submit("cmd");
+        server.drain();
+        CHECK(client.wait(ticket).status == shm_status::ok);
+    }
+    
+    SECTION("submissions longer than a slot fail")
+    {
+        // a client writing past its slot, by hand
+        const int fd = shm_open(ring_name().c_str(), O_RDWR, 0);
+        REQUIRE(fd >= 0);
+        const auto size = detail::shm_size(8, 64);
+        void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        REQUIRE(memory != MAP_FAILED);
+        
+        auto* header = static_cast<detail::shm_header*>(memory);
+        auto* slot = reinterpret_cast<detail::shm_submission*>(header + 1);
+        
+        header->tail.store(1);
+        std::memcpy(reinterpret_cast<char*>(slot + 1), "cmd", 3);
+        slot->length = 100000;
+        slot->sequence.store(1);
+        
+        header->capacity = 1u << 30;
+        header->line_size = 1u << 30;
+        
+        server.drain();
+        
+        const auto* completion = reinterpret_cast<detail::shm_completion*>(
+            reinterpret_cast<char*>(slot) + 8 * detail::shm_submission_size(64));
+        CHECK(completion->ticket.load() == 1);
+        CHECK(completion->status == static_cast<int32_t>(shm_status::failed));
+        CHECK(executed == 0);
+        
+        munmap(memory, size);
+    }
+}
+
+TEST_CASE("many clients can submit commands concurrently")
+{
+    constexpr int client_count = 4;
+    constexpr int commands_per_client = 2000;
+    
+    std::vector<std::vector<int>> executed(client_count);
+    auto cr = command_runner(command{"cmd", [&](size_t client, int i) { executed[client].push_back(i); }});
+    
+    shm_server server(cr, ring_name(), 16);
+    std::atomic<bool> stop{false};
+    std::thread serving([&]() { server.serve(stop); });
+    
+    std::vector<std::thread> clients;
+    for (int c = 0; c < client_count; c++) {
+        clients.emplace_back([c]() {
+            shm_client client(ring_name());
+            for (int i = 0; i < commands_per_client; i++) {
+                client.submit("cmd " + std::to_string(c) + " " + std::to_string(i));
+            }
+        });
+    }
+    
+    for (auto& client : clients) {
+        client.join();
+    }
+    
+    shm_client client(ring_name());
+    client.run("");
+    
+    stop = true;
+    server.notify();
+    serving.join();
+    
+    for (const auto& commands : executed) {
+        REQUIRE(commands.size() == commands_per_client);
+        for (int i = 0; i < commands_per_client; i++) {
+            CHECK(commands[static_cast<size_t>(i)] == i);
+        }
+    }
+}
+
+TEST_CASE("commands can be submitted from another process")
+{
+    int sum = 0;
+    auto cr = command_runner(command{"add", [&](int a) { sum += a; }});
+    const auto name = ring_name();
+    shm_server server(cr, name);
+    
+    const pid_t child = fork();
+    if (child == 0) {
+        try {
+            shm_client client(name);
+            const bool ok = client.run("add 20").status == shm_status::ok
+                && client.run("add 22").status == shm_status::ok;
+            _exit(ok ? 0 : 1);
+        } catch (...) {
+            _exit(2);
+        }
+    }
+    
+    REQUIRE(child > 0);
+    
+    int status = 0;
+    while (waitpid(child, &status, WNOHANG) == 0) {
+        server.drain();
+    }
+    
+    CHECK(WIFEXITED(status));
+    CHECK(WEXITSTATUS(status) == 0);
+    CHECK(sum == 42);
+}
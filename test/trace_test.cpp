@@ -0,0 +1,118 @@
+#include <catch2/catch.hpp>
+#include "cmdrun.hpp"
+
+using namespace cmdrun;
+
+namespace {
+
+size_t count_of(const std::string& text, const std::string& pattern)
+{
+    size_t count = 0;
+    for (auto pos = text.find(pattern); pos != std::string::npos; pos = text.find(pattern, pos + 1)) {
+        count++;
+    }
+    return count;
+}
+
+// thread index of the first span with the given name
+std::string thread_of(const std::string& trace, const std::string& name)
+{
+    const auto span = trace.find("\"name\":\"" + name + "\"");
+    const auto tid = trace.find("\"tid\":", span) + 6;
+    return trace.substr(tid, trace.find(',', tid) - tid);
+}
+
+std::string chrome_trace(const tracer& t)
+{
+    std::ostringstream os;
+    t.write_chrome_trace(os);
+    return os.str();
+}
+
+}
+
+TEST_CASE("can trace command execution")
+{
+    tracer t;
+    auto cp = command_runner(command{"cmd", [](int, std::string, std::vector<int>) {}});
+    
+    SECTION("nothing is recorded without a tracer")
+    {
+        cp.run("cmd 1 a {}");
+        CHECK(count_of(chrome_trace(t), "\"ph\":\"X\"") == 0);
+    }
+    
+    SECTION("every stage of a command is recorded")
+    {
+        cp.set_tracer(&t);
+        cp.run("cmd 123 \"two words\" {1, 2}");
+        cp.run("unknown");
+        cp.set_tracer(nullptr);
+        cp.run("cmd 1 a {}");
+        
+        const auto trace = chrome_trace(t);
+        
+        CHECK(trace.find("{\"traceEvents\":[") == 0);
+        CHECK(count_of(trace, "\"name\":\"tokenize\"") == 2);
+        CHECK(count_of(trace, "\"name\":\"lookup\"") == 2);
+        CHECK(count_of(trace, "\"name\":\"parse\"") == 3);
+        CHECK(count_of(trace, "\"name\":\"execute\"") == 1);
+        
+        CHECK(count_of(trace, "\"command\":\"unknown\"") == 2);
+        CHECK(count_of(trace, "\"type\":\"int\",\"bytes\":4") == 1);
+        CHECK(count_of(trace, "\"bytes\":12") == 1);
+        CHECK(count_of(trace, "\"type\":\"std::vector<int, std::allocator<int> >\",\"bytes\":7") == 1);
+    }
+    
+    SECTION("pipelined commands are executed on the calling thread")
+    {
+        cp.set_tracer(&t);
+        
+        std::istringstream script("cmd 1 a {}\ncmd 2 b {}\n");
+        cp.run_pipelined(script);
+        
+        const auto trace = chrome_trace(t);
+        
+        CHECK(count_of(trace, "\"name\":\"execute\"") == 2);
+        CHECK(count_of(trace, "\"name\":\"parse\"") == 6);
+        CHECK(thread_of(trace, "execute") != thread_of(trace, "parse"));
+        CHECK(thread_of(trace, "tokenize") == thread_of(trace, "parse"));
+    }
+    
+    SECTION("many spans can be recorded")
+    {
+        cp.set_tracer(&t);
+        
+        for (int i = 0; i < 1000; i++) {
+            cp.run("cmd 1 a {}");
+        }
+        
+        CHECK(count_of(chrome_trace(t), "\"ph\":\"X\"") == 6000);
+    }
+    
+    SECTION("only the latest spans of a thread are kept")
+    {
+        tracer small{16};
+        cp.set_tracer(&small);
+        
+        for (int i = 0; i < 1000; i++) {
+            cp.run("cmd 1 a {}");
+        }
+        cp.run("cmd 2 last {}");
+        
+        const auto trace = chrome_trace(small);
+        CHECK(count_of(trace, "\"ph\":\"X\"") == 16);
+        CHECK(count_of(trace, "\"bytes\":5") == 1);
+        CHECK(trace.rfind("\"name\":\"execute\"") > trace.find("\"bytes\":5"));
+    }
+}
+
+TEST_CASE("command names are escaped in traces")
+{
+    tracer t;
+    auto cp = command_runner();
+    cp.set_tracer(&t);
+    cp.run("a\"b\\c");
+    
+    CHECK(chrome_trace(t).find("\"command\":\"a\\\"b\\\\c\"") != std::string::npos);
+}